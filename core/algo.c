@@ -2,176 +2,518 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+
+#include "libs/analyze.h"
+#include "libs/batch.h"
+#include "libs/codec.h"
+#include "libs/heatmap.h"
+#include "libs/imgio.h"
+#include "libs/serve.h"
+
+#define DEFAULT_STRIP_ROWS 64
+#define DEFAULT_HEATMAP_BLOCK 8
+#define DEFAULT_SAMPLE_EVERY 8
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-1..-4] [--stream[=ROWS]] [--stats=json|csv] [--heatmap=PNG] <input.bmp> <compressed.pp> <decoded.bmp>\n", prog);
+    fprintf(stderr, "Example: %s static/venice.bmp static/compressed.pp static/decoded.bmp\n", prog);
+    fprintf(stderr, "\n  -1 .. -4         effort: -1 fastest, -4 densest (default -%d)\n", PP_EFFORT_DEFAULT);
+    fprintf(stderr, "  --stream[=ROWS]  encode/decode in strips of ROWS rows (default %d) so memory\n", DEFAULT_STRIP_ROWS);
+    fprintf(stderr, "                   use stays constant regardless of image height\n");
+    fprintf(stderr, "  --stats=FORMAT   print only a json object or a csv header and row with\n");
+    fprintf(stderr, "                   per-stage time and bytes, coder events and peak memory\n");
+    fprintf(stderr, "  --heatmap=PNG    write the coded bits per pixel, averaged over %dx%d blocks\n", DEFAULT_HEATMAP_BLOCK, DEFAULT_HEATMAP_BLOCK);
+    fprintf(stderr, "                   (--heatmap-block=N; 1 = per pixel), as a PNG heatmap from\n");
+    fprintf(stderr, "                   black (0) through blue, red and yellow to white (%.0f)\n", HEATMAP_MAX_BITS);
+    fprintf(stderr, "\n       %s batch [-d] [-j THREADS] [-1..-4] [--stream[=ROWS]] [--huge-pages] <outdir> <input|dir|@list>...\n", prog);
+    fprintf(stderr, "  Encodes every input to <outdir>/<name>.pp (or decodes .pp files to\n");
+    fprintf(stderr, "  <outdir>/<name>.bmp with -d) on a thread pool, one per CPU by default\n");
+    fprintf(stderr, "\n       %s serve [-j THREADS] [--huge-pages] <socket>\n", prog);
+    fprintf(stderr, "  Runs a resident encoder/decoder on a Unix socket (see libs/serve.h)\n");
+    fprintf(stderr, "\n       %s request <socket> encode|decode [-1..-4] [--stream[=ROWS]] <input> <output>\n", prog);
+    fprintf(stderr, "  Sends one request to a running server\n");
+    fprintf(stderr, "\n       %s analyze [--tile=N] [--csv=FILE] <input|dir|@list|results.csv>...\n", prog);
+    fprintf(stderr, "  Reports per-channel entropy of raw pixels, left and MED residuals and MED\n");
+    fprintf(stderr, "  after subtracting green against the bits actually coded; --csv writes the\n");
+    fprintf(stderr, "  same per N x N tile (default %d). A .csv input names the images in its\n", ANALYZE_DEFAULT_TILE);
+    fprintf(stderr, "  first column, as in benchmark output\n");
+    fprintf(stderr, "\n       %s estimate [-1..-4] [--stream[=ROWS]] [--sample=N] [--verify] <input|dir|@list>...\n", prog);
+    fprintf(stderr, "  Predicts each compressed size from every Nth row (default %d) without\n", DEFAULT_SAMPLE_EVERY);
+    fprintf(stderr, "  encoding; --verify also encodes and prints the estimate's error\n");
+}
+
+static int parse_stream(const char* arg, int* strip_rows) {
+    if (strcmp(arg, "--stream") == 0) {
+        *strip_rows = DEFAULT_STRIP_ROWS;
+        return 0;
+    }
+    if (strncmp(arg, "--stream=", 9) == 0) {
+        *strip_rows = atoi(arg + 9);
+        return *strip_rows > 0 ? 0 : -1;
+    }
+    return -1;
+}
+
+// "-1" .. "-4"
+static int parse_effort(const char* arg, int* effort) {
+    if (arg[0] != '-' || arg[1] < '0' + PP_EFFORT_MIN || arg[1] > '0' + PP_EFFORT_MAX || arg[2]) return -1;
+    *effort = arg[1] - '0';
+    return 0;
+}
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "libs/stb_image.h"
+typedef enum { STATS_NONE, STATS_JSON, STATS_CSV } stats_format;
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "libs/stb_image_write.h"
+static int parse_stats(const char* arg, stats_format* format) {
+    if (strcmp(arg, "--stats=json") == 0) *format = STATS_JSON;
+    else if (strcmp(arg, "--stats=csv") == 0) *format = STATS_CSV;
+    else return -1;
+    return 0;
+}
 
-#include "libs/arith.h"
+typedef struct {
+    const char* input;
+    int width, height;
+    int effort;
+    int strip_rows;
+    uint64_t raw_bytes;
+    uint64_t compressed_bytes;
+    double encode_seconds, decode_seconds;
+    long peak_rss_bytes;
+} run_info;
+
+static void json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
 
-int loco_predict(int a, int b, int c) {
-    int p = a + b - c;
-    if (c >= (a > b ? a : b)) return (a < b) ? a : b;
-    else if (c <= (a < b ? a : b)) return (a > b) ? a : b;
-    else return p;
+// RLE output over input; above 1 the stage grew the data
+static double rle_expansion(const pp_stats* st) {
+    uint64_t in = st->bytes_in[PP_STAGE_RLE];
+    return in ? (double)st->bytes_out[PP_STAGE_RLE] / in : 0.0;
 }
 
-void compute_residuals(const uint8_t* src, int width, int height, uint8_t* residuals) {
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * width + x;
-            int a = x > 0 ? src[y * width + (x - 1)] : 0;
-            int b = y > 0 ? src[(y - 1) * width + x] : 0;
-            int c = (x > 0 && y > 0) ? src[(y - 1) * width + (x - 1)] : 0;
+static void print_stats_json(FILE* f, const run_info* r, const pp_stats* st) {
+    fprintf(f, "{\"input\": ");
+    json_string(f, r->input);
+    fprintf(f, ", \"width\": %d, \"height\": %d, \"effort\": %d, \"strip_rows\": %d,\n",
+            r->width, r->height, r->effort, r->strip_rows);
+    fprintf(f, " \"raw_bytes\": %llu, \"compressed_bytes\": %llu, \"encode_seconds\": %.6f, "
+               "\"decode_seconds\": %.6f,\n",
+            (unsigned long long)r->raw_bytes, (unsigned long long)r->compressed_bytes,
+            r->encode_seconds, r->decode_seconds);
+    fprintf(f, " \"rle_expansion\": %.4f, \"strips\": %llu, \"stored_strips\": %llu, \"arena_bytes\": %zu, "
+               "\"peak_rss_bytes\": %ld,\n",
+            rle_expansion(st), (unsigned long long)st->strips, (unsigned long long)st->stored_strips,
+            st->arena_bytes, r->peak_rss_bytes);
+    fprintf(f, " \"stages\": [\n");
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        fprintf(f, "  {\"name\": \"%s\", \"seconds\": %.6f, \"bytes_in\": %llu, \"bytes_out\": %llu, "
+                   "\"rescales\": %llu, \"underflows\": %llu}%s\n",
+                pp_stage_names[s], st->seconds[s], (unsigned long long)st->bytes_in[s],
+                (unsigned long long)st->bytes_out[s], (unsigned long long)st->rescales[s],
+                (unsigned long long)st->underflows[s], s + 1 < PP_STAGE_COUNT ? "," : "");
+    }
+    fprintf(f, " ]}\n");
+}
 
-            int pred = loco_predict(a, b, c);
-            int res = (int)src[idx] - pred;
-            residuals[idx] = (uint8_t)res;
+// One header line and one row, so runs can be appended to a single file
+// by dropping every header after the first
+static void print_stats_csv(FILE* f, const run_info* r, const pp_stats* st) {
+    fprintf(f, "input,width,height,effort,strip_rows,raw_bytes,compressed_bytes,encode_seconds,decode_seconds,"
+               "rle_expansion,strips,stored_strips,arena_bytes,peak_rss_bytes");
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        const char* n = pp_stage_names[s];
+        fprintf(f, ",%s_seconds,%s_bytes_in,%s_bytes_out", n, n, n);
+        if (s == PP_STAGE_ENTROPY || s == PP_STAGE_ENTROPY_DEC) fprintf(f, ",%s_rescales,%s_underflows", n, n);
+    }
+    fprintf(f, "\n%s,%d,%d,%d,%d,%llu,%llu,%.6f,%.6f,%.4f,%llu,%llu,%zu,%ld", r->input, r->width, r->height,
+            r->effort, r->strip_rows, (unsigned long long)r->raw_bytes, (unsigned long long)r->compressed_bytes,
+            r->encode_seconds, r->decode_seconds, rle_expansion(st), (unsigned long long)st->strips,
+            (unsigned long long)st->stored_strips, st->arena_bytes, r->peak_rss_bytes);
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        fprintf(f, ",%.6f,%llu,%llu", st->seconds[s], (unsigned long long)st->bytes_in[s],
+                (unsigned long long)st->bytes_out[s]);
+        if (s == PP_STAGE_ENTROPY || s == PP_STAGE_ENTROPY_DEC) {
+            fprintf(f, ",%llu,%llu", (unsigned long long)st->rescales[s], (unsigned long long)st->underflows[s]);
         }
     }
+    fprintf(f, "\n");
+}
+
+static double elapsed_since(const struct timespec* t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+// Process high-water mark, or -1 if unknown
+static long peak_rss_bytes(void) {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss * 1024L : -1;
 }
 
-void inverse_predict_loco_i(const uint8_t* resid, uint8_t* out, int wid, int ht) {
-    for (int y=0; y < ht; y++) {
-        for (int x=0; x < wid; x++) {
-            int idx = y * wid + x;
-            int a = x > 0 ? out[y * wid + (x - 1)] : 0;
-            int b = y > 0 ? out[(y - 1) * wid + x] : 0;
-            int c = (x > 0 && y > 0) ? out[(y - 1) * wid + (x - 1)] : 0;
-            int pred = loco_predict(a, b, c);
+static int batch_main(int argc, char* argv[], const char* prog) {
+    int decode = 0, threads = 0, strip_rows = 0, huge_pages = 0, effort = PP_EFFORT_DEFAULT;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strcmp(argv[argi], "-d") == 0) {
+            decode = 1;
+        } else if (strcmp(argv[argi], "--huge-pages") == 0) {
+            huge_pages = 1;
+        } else if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+            threads = atoi(argv[++argi]);
+        } else if (parse_effort(argv[argi], &effort) != 0 && parse_stream(argv[argi], &strip_rows) != 0) {
+            usage(prog);
+            return 1;
+        }
+    }
+    if (argc - argi < 2) {
+        usage(prog);
+        return 1;
+    }
 
-            int val = (pred + resid[idx]) & 0xFF;
-            out[idx] = (uint8_t)val;
+    const char* outdir = argv[argi++];
+    batch_list list = {0};
+    for (; argi < argc; argi++) {
+        if (batch_add(&list, argv[argi], outdir, decode ? ".bmp" : ".pp") != 0) {
+            fprintf(stderr, "Cannot read input: %s\n", argv[argi]);
+            batch_free(&list);
+            return 1;
         }
     }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int failed = batch_run(&list, threads, decode, strip_rows, effort, huge_pages, 1);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    uint64_t in_bytes = 0, out_bytes = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        in_bytes += list.jobs[i].in_bytes;
+        out_bytes += list.jobs[i].out_bytes;
+    }
+    printf("%zu images (%d failed): %llu -> %llu bytes in %.3f s (%.1f MB/s)\n",
+           list.count, failed, (unsigned long long)in_bytes, (unsigned long long)out_bytes,
+           elapsed, elapsed > 0 ? in_bytes / elapsed / 1e6 : 0.0);
+    batch_free(&list);
+    return failed ? 1 : 0;
+}
+
+static int serve_main(int argc, char* argv[], const char* prog) {
+    int threads = 0, huge_pages = 0;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+            threads = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--huge-pages") == 0) {
+            huge_pages = 1;
+        } else {
+            usage(prog);
+            return 1;
+        }
+    }
+    if (argc - argi != 1) {
+        usage(prog);
+        return 1;
+    }
+    return serve_run(argv[argi], threads, huge_pages) == 0 ? 0 : 1;
+}
+
+static int request_main(int argc, char* argv[], const char* prog) {
+    int strip_rows = 0, effort = 0;
+    while (argc > 5 && (parse_stream(argv[3], &strip_rows) == 0 || parse_effort(argv[3], &effort) == 0)) {
+        for (int i = 3; i + 1 < argc; i++) argv[i] = argv[i + 1];
+        argc--;
+    }
+    if (argc != 5 || (strcmp(argv[2], "encode") != 0 && strcmp(argv[2], "decode") != 0)) {
+        usage(prog);
+        return 1;
+    }
+    uint32_t op = strcmp(argv[2], "encode") == 0 ? SERVE_ENCODE : SERVE_DECODE;
+
+    int in_fd = open(argv[3], O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0) {
+        fprintf(stderr, "Cannot read input: %s\n", argv[3]);
+        return 1;
+    }
+    int out_fd;
+    uint64_t out_len;
+    int ret = serve_call(argv[1], op, strip_rows, effort, in_fd, &out_fd, &out_len);
+    close(in_fd);
+    if (ret != 0) {
+        fprintf(stderr, "Request failed\n");
+        return 1;
+    }
+
+    int fd = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    off_t off = 0;
+    while (fd >= 0 && (uint64_t)off < out_len) {
+        if (sendfile(fd, out_fd, &off, out_len - off) <= 0) break;
+    }
+    close(out_fd);
+    if (fd < 0 || close(fd) != 0 || (uint64_t)off != out_len) {
+        fprintf(stderr, "Cannot write output: %s\n", argv[4]);
+        return 1;
+    }
+    printf("%s: %llu bytes\n", argv[4], (unsigned long long)out_len);
+    return 0;
+}
+
+// Image paths from the first column of a benchmark CSV
+static int add_csv_inputs(batch_list* list, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    char line[4096];
+    int ret = 0;
+    for (int row = 0; ret == 0 && fgets(line, sizeof(line), f); row++) {
+        line[strcspn(line, ",\r\n")] = 0;
+        if (row > 0 && line[0] && strcmp(line, "(aggregate)") != 0) ret = batch_add(list, line, ".", "");
+    }
+    fclose(f);
+    return ret;
 }
 
-unsigned char* rle_encode(const unsigned char* data, size_t len, size_t* out_len) {
-    size_t capacity = len * 2 + 1024;
-    unsigned char* out = malloc(capacity);
-    size_t pos = 0, i = 0;
-    while (i < len) {
-        size_t run = 1;
-        while (i + run < len && data[i] == data[i + run] && run < 255) run++;
-        if (pos + 2 > capacity) {
-            capacity *= 2;
-            out = realloc(out, capacity);
+static int analyze_main(int argc, char* argv[], const char* prog) {
+    int tile = ANALYZE_DEFAULT_TILE;
+    const char* csv = NULL;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strncmp(argv[argi], "--tile=", 7) == 0) {
+            tile = atoi(argv[argi] + 7);
+        } else if (strncmp(argv[argi], "--csv=", 6) == 0) {
+            csv = argv[argi] + 6;
+        } else {
+            usage(prog);
+            return 1;
+        }
+    }
+    if (argi == argc || tile < 1) {
+        usage(prog);
+        return 1;
+    }
+
+    batch_list list = {0};
+    for (; argi < argc; argi++) {
+        size_t len = strlen(argv[argi]);
+        int ret = len > 4 && strcmp(argv[argi] + len - 4, ".csv") == 0 ? add_csv_inputs(&list, argv[argi])
+                                                                          : batch_add(&list, argv[argi], ".", "");
+        if (ret != 0) {
+            fprintf(stderr, "Cannot read input: %s\n", argv[argi]);
+            batch_free(&list);
+            return 1;
         }
-        out[pos++] = (unsigned char)run;
-        out[pos++] = data[i];
-        i += run;
     }
-    *out_len = pos;
-    return out;
+    int failed = analyze_run(&list, tile, csv);
+    batch_free(&list);
+    return failed ? 1 : 0;
 }
 
-unsigned char* rle_decode(const unsigned char* data, size_t len, size_t out_len) {
-    unsigned char* out = malloc(out_len);
-    if (!out) return NULL;
+static int estimate_main(int argc, char* argv[], const char* prog) {
+    int effort = PP_EFFORT_DEFAULT, strip_rows = 0, sample_every = DEFAULT_SAMPLE_EVERY, verify = 0;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strncmp(argv[argi], "--sample=", 9) == 0) {
+            sample_every = atoi(argv[argi] + 9);
+        } else if (strcmp(argv[argi], "--verify") == 0) {
+            verify = 1;
+        } else if (parse_effort(argv[argi], &effort) != 0 && parse_stream(argv[argi], &strip_rows) != 0) {
+            usage(prog);
+            return 1;
+        }
+    }
+    if (argi == argc || sample_every < 1) {
+        usage(prog);
+        return 1;
+    }
 
-    size_t pos = 0, i = 0;
-    while (i + 1 < len && pos < out_len) {
-        unsigned char run = data[i++];
-        unsigned char val = data[i++];
-        for (int j = 0; j < run && pos < out_len; j++) {
-            out[pos++] = val;
+    batch_list list = {0};
+    for (; argi < argc; argi++) {
+        if (batch_add(&list, argv[argi], ".", "") != 0) {
+            fprintf(stderr, "Cannot read input: %s\n", argv[argi]);
+            batch_free(&list);
+            return 1;
         }
     }
 
-    while (pos < out_len) {
-        out[pos++] = 0;
+    pp_options opts = pp_preset(effort);
+    pp_context* ctx = verify ? pp_context_create(0) : NULL;
+    FILE* sink = verify ? fopen("/dev/null", "wb") : NULL;
+    if (verify && (!ctx || !sink)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    int failed = 0;
+    uint64_t raw_total = 0, est_total = 0, real_total = 0;
+    double est_seconds = 0, real_seconds = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        const char* path = list.jobs[i].input;
+        image_view img;
+        if (image_open(path, &img) != 0) {
+            fprintf(stderr, "Failed to load %s: %s\n", path, image_failure_reason());
+            failed++;
+            continue;
+        }
+        uint64_t raw = (uint64_t)img.width * img.height * 3;
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t est = pp_estimate(&img, strip_rows, &opts, sample_every);
+        est_seconds += elapsed_since(&t0);
+        raw_total += raw;
+        est_total += est;
+        printf("%s: %llu -> ~%llu bytes (%.1f%%)", path, (unsigned long long)raw, (unsigned long long)est,
+               100.0 * est / raw);
+
+        uint64_t real = 0;
+        if (verify) {
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            if (pp_encode(ctx, &img, strip_rows, &opts, sink, &real) != 0) failed++;
+            real_seconds += elapsed_since(&t0);
+            real_total += real;
+            printf(", actual %llu (%+.1f%%)", (unsigned long long)real, real ? 100.0 * ((double)est / real - 1) : 0.0);
+        }
+        printf("\n");
+        image_close(&img);
     }
 
-    return out;
+    if (list.count > 1) {
+        printf("total: %llu -> ~%llu bytes (%.1f%%)", (unsigned long long)raw_total,
+               (unsigned long long)est_total, raw_total ? 100.0 * est_total / raw_total : 0.0);
+        if (verify) printf(", actual %llu (%+.1f%%)", (unsigned long long)real_total,
+                           real_total ? 100.0 * ((double)est_total / real_total - 1) : 0.0);
+        printf("\n");
+    }
+    printf("estimate: %.1f MB/s", est_seconds > 0 ? raw_total / est_seconds / 1e6 : 0.0);
+    if (verify) printf(", encode: %.1f MB/s", real_seconds > 0 ? raw_total / real_seconds / 1e6 : 0.0);
+    printf("\n");
+
+    if (sink) fclose(sink);
+    pp_context_free(ctx);
+    batch_free(&list);
+    return failed ? 1 : 0;
 }
 
 int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+        return batch_main(argc - 1, argv + 1, argv[0]);
+    }
+    if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+        return serve_main(argc - 1, argv + 1, argv[0]);
+    }
+    if (argc > 1 && strcmp(argv[1], "request") == 0) {
+        return request_main(argc - 1, argv + 1, argv[0]);
+    }
+    if (argc > 1 && strcmp(argv[1], "analyze") == 0) {
+        return analyze_main(argc - 1, argv + 1, argv[0]);
+    }
+    if (argc > 1 && strcmp(argv[1], "estimate") == 0) {
+        return estimate_main(argc - 1, argv + 1, argv[0]);
+    }
+
+    int strip_rows = 0, effort = PP_EFFORT_DEFAULT;
+    stats_format stats_fmt = STATS_NONE;
+    const char* heatmap = NULL;
+    int heatmap_block = DEFAULT_HEATMAP_BLOCK;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strncmp(argv[argi], "--heatmap=", 10) == 0) {
+            heatmap = argv[argi] + 10;
+        } else if (strncmp(argv[argi], "--heatmap-block=", 16) == 0) {
+            heatmap_block = atoi(argv[argi] + 16);
+            if (heatmap_block < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (parse_effort(argv[argi], &effort) != 0 && parse_stream(argv[argi], &strip_rows) != 0 &&
+            parse_stats(argv[argi], &stats_fmt) != 0) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
     // Check for correct number of arguments
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <input.bmp> <compressed.pp> <decoded.bmp>\n", argv[0]);
-        fprintf(stderr, "Example: %s static/venice.bmp static/compressed.pp static/decoded.bmp\n", argv[0]);
+    if (argc - argi != 3) {
+        usage(argv[0]);
         return 1;
     }
 
-    const char* inpath = argv[1];
-    const char* outcompressed = argv[2];
-    const char* outdecoded = argv[3];
+    const char* inpath = argv[argi];
+    const char* outcompressed = argv[argi + 1];
+    const char* outdecoded = argv[argi + 2];
+
+    // With --stats the record is the only thing on stdout
+    FILE* log = stats_fmt == STATS_NONE ? stdout : fopen("/dev/null", "w");
+    pp_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    pp_context* ctx = NULL;
+    if (stats_fmt != STATS_NONE || heatmap) {
+        ctx = pp_context_create(0);
+        if (!ctx || !log) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        pp_set_stats(ctx, &stats);
+    }
+    run_info info = { inpath, 0, 0, effort, strip_rows, 0, 0, 0, 0, -1 };
+    struct timespec t0;
 
     // ============ COMPRESSION ============
-    int width, height, channels;
-    unsigned char* img = stbi_load(inpath, &width, &height, &channels, 3);
-    if (!img) {
-        fprintf(stderr, "Failed to load image: %s\n", stbi_failure_reason());
-        return 1;
-    }
-
-    printf("Compressing %dx%d image...\n", width, height);
-    size_t px_count = (size_t)width * height;
-    size_t total_len = px_count * 3;
-
-    // Separate channels
-    uint8_t* r_chan = malloc(px_count);
-    uint8_t* g_chan = malloc(px_count);
-    uint8_t* b_chan = malloc(px_count);
-    for (size_t i = 0; i < px_count; i++) {
-        r_chan[i] = img[3*i];
-        g_chan[i] = img[3*i + 1];
-        b_chan[i] = img[3*i + 2];
-    }
-    free(img);
-
-    // Compute residuals
-    uint8_t* res_r = malloc(px_count);
-    uint8_t* res_g = malloc(px_count);
-    uint8_t* res_b = malloc(px_count);
-    compute_residuals(r_chan, width, height, res_r);
-    compute_residuals(g_chan, width, height, res_g);
-    compute_residuals(b_chan, width, height, res_b);
-    free(r_chan);
-    free(g_chan);
-    free(b_chan);
-
-    // Concatenate
-    unsigned char* combined = malloc(total_len);
-    memcpy(combined, res_r, px_count);
-    memcpy(combined + px_count, res_g, px_count);
-    memcpy(combined + 2 * px_count, res_b, px_count);
-    free(res_r);
-    free(res_g);
-    free(res_b);
-
-    // RLE encode
-    size_t rle_len;
-    unsigned char* rle_data = rle_encode(combined, total_len, &rle_len);
-    free(combined);
-
-    // Arithmetic encode
-    size_t arith_capacity = rle_len + 4096;
-    unsigned char* arith_out = malloc(arith_capacity);
-    size_t arith_len = arithmetic_encode(rle_data, rle_len, arith_out, arith_capacity);
-    free(rle_data);
-
-    // Write file
+    image_view img;
+    if (image_open(inpath, &img) != 0) {
+        fprintf(stderr, "Failed to load image: %s\n", image_failure_reason());
+        return 1;
+    }
+
+    fprintf(log, "Compressing %dx%d image...\n", img.width, img.height);
+    size_t total_len = (size_t)img.width * img.height * 3;
+    info.width = img.width;
+    info.height = img.height;
+    info.raw_bytes = total_len;
+    if (heatmap && !(stats.bit_map = calloc((size_t)img.width * img.height, sizeof(float)))) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
     FILE* fout = fopen(outcompressed, "wb");
     if (!fout) {
         fprintf(stderr, "Cannot write output file\n");
         return 1;
     }
-    fwrite(&width, sizeof(int), 1, fout);
-    fwrite(&height, sizeof(int), 1, fout);
-    int nchannels = 3;
-    fwrite(&nchannels, sizeof(int), 1, fout);
-    fwrite(&total_len, sizeof(size_t), 1, fout);
-    fwrite(&rle_len, sizeof(size_t), 1, fout);
-    fwrite(&arith_len, sizeof(size_t), 1, fout);
-    fwrite(arith_out, 1, arith_len, fout);
-    fclose(fout);
-    free(arith_out);
+    uint64_t compressed_len;
+    pp_options opts = pp_preset(effort);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int ret = pp_encode(ctx, &img, strip_rows, &opts, fout, &compressed_len);
+    info.encode_seconds = elapsed_since(&t0);
+    info.compressed_bytes = compressed_len;
+    image_close(&img);
+    if (fclose(fout) != 0 || ret != 0) {
+        fprintf(stderr, "Compression failed\n");
+        return 1;
+    }
 
-    printf("Compressed: %zu -> %zu bytes (%.1f%%)\n",
-           total_len, arith_len, 100.0 * arith_len / total_len);
+    fprintf(log, "Compressed: %zu -> %llu bytes (%.1f%%)\n",
+           total_len, (unsigned long long)compressed_len, 100.0 * compressed_len / total_len);
+
+    if (heatmap) {
+        double hottest;
+        if (heatmap_write_png(heatmap, stats.bit_map, info.width, info.height, heatmap_block, &hottest) != 0) {
+            fprintf(stderr, "Cannot write heatmap: %s\n", heatmap);
+            return 1;
+        }
+        fprintf(log, "Heatmap: %s (hottest block %.2f bits/pixel)\n", heatmap, hottest);
+        free(stats.bit_map);
+        stats.bit_map = NULL;
+    }
 
     // ============ DECOMPRESSION ============
     FILE* fin = fopen(outcompressed, "rb");
@@ -180,66 +522,38 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    int d_w, d_h, d_ch;
-    size_t d_total, d_rle, d_arith;
-    fread(&d_w, sizeof(int), 1, fin);
-    fread(&d_h, sizeof(int), 1, fin);
-    fread(&d_ch, sizeof(int), 1, fin);
-    fread(&d_total, sizeof(size_t), 1, fin);
-    fread(&d_rle, sizeof(size_t), 1, fin);
-    fread(&d_arith, sizeof(size_t), 1, fin);
+    pp_header hdr;
+    if (pp_read_header(fin, &hdr) != 0) {
+        fprintf(stderr, "Invalid compressed file\n");
+        fclose(fin);
+        return 1;
+    }
+
+    fprintf(log, "Decompressing...\n");
 
-    unsigned char* enc_data = malloc(d_arith);
-    fread(enc_data, 1, d_arith, fin);
+    image_view out;
+    if (image_create(outdecoded, hdr.width, hdr.height, &out) != 0) {
+        fprintf(stderr, "Cannot write decoded image: %s\n", image_failure_reason());
+        fclose(fin);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ret = pp_decode(ctx, fin, &hdr, &out);
+    info.decode_seconds = elapsed_since(&t0);
+    image_close(&out);
     fclose(fin);
+    if (ret != 0) {
+        fprintf(stderr, "Decompression failed\n");
+        return 1;
+    }
 
-    printf("Decompressing...\n");
-
-    // Arithmetic decode
-    unsigned char* rle_decoded = malloc(d_rle);
-    arithmetic_decode(enc_data, d_arith, rle_decoded, d_rle);
-    free(enc_data);
-
-    // RLE decode
-    unsigned char* decoded_residuals = rle_decode(rle_decoded, d_rle, d_total);
-    free(rle_decoded);
-
-    // Separate channels
-    size_t px_dec = d_w * d_h;
-    uint8_t* res_r_dec = malloc(px_dec);
-    uint8_t* res_g_dec = malloc(px_dec);
-    uint8_t* res_b_dec = malloc(px_dec);
-    memcpy(res_r_dec, decoded_residuals, px_dec);
-    memcpy(res_g_dec, decoded_residuals + px_dec, px_dec);
-    memcpy(res_b_dec, decoded_residuals + 2 * px_dec, px_dec);
-    free(decoded_residuals);
-
-    // Inverse prediction
-    uint8_t* img_r = calloc(px_dec, 1);
-    uint8_t* img_g = calloc(px_dec, 1);
-    uint8_t* img_b = calloc(px_dec, 1);
-
-    inverse_predict_loco_i(res_r_dec, img_r, d_w, d_h);
-    inverse_predict_loco_i(res_g_dec, img_g, d_w, d_h);
-    inverse_predict_loco_i(res_b_dec, img_b, d_w, d_h);
-    free(res_r_dec);
-    free(res_g_dec);
-    free(res_b_dec);
-
-    // Interleave and write
-    unsigned char* decoded_img = malloc(px_dec * 3);
-    for (size_t i = 0; i < px_dec; i++) {
-        decoded_img[3 * i] = img_r[i];
-        decoded_img[3 * i + 1] = img_g[i];
-        decoded_img[3 * i + 2] = img_b[i];
-    }
-
-    stbi_write_bmp(outdecoded, d_w, d_h, 3, decoded_img);
-    free(img_r);
-    free(img_g);
-    free(img_b);
-    free(decoded_img);
-
-    printf("Done! Saved to %s\n", outdecoded);
+    fprintf(log, "Done! Saved to %s\n", outdecoded);
+    if (stats_fmt != STATS_NONE) {
+        info.peak_rss_bytes = peak_rss_bytes();
+        if (stats_fmt == STATS_JSON) print_stats_json(stdout, &info, &stats);
+        else print_stats_csv(stdout, &info, &stats);
+        fclose(log);
+    }
+    pp_context_free(ctx);
     return 0;
 }
@@ -1,17 +1,178 @@
 // benchmark.c
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <stdint.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
-#define STB_IMAGE_IMPLEMENTATION
 #include "libs/stb_image.h"
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "libs/stb_image_write.h"
 
+#include "libs/codec.h"
+#include "libs/imgio.h"
+#include "libs/perfctr.h"
+#include "libs/pool.h"
+#include "libs/synth.h"
+
+#define DEFAULT_WARMUP 1
+#define DEFAULT_REPS 5
+#define DEFAULT_SIZE_TOLERANCE 0.1     // percent
+#define DEFAULT_SPEED_TOLERANCE 10.0   // percent
+#define DEFAULT_SYNTH_MEGAPIXELS 16
+#define MIN_GATED_PIXELS (256 * 256)    // smaller images finish in timer noise
+#define MIN_STAGE_SHARE 0.10            // of the roundtrip, for a stage to be gated
+
+typedef struct {
+    uint64_t bytes, count;
+} alloc_totals;
+
+// Allocation hook: every malloc, calloc, realloc and aligned allocation
+// (posix_memalign, aligned_alloc, memalign, valloc) made through the
+// dynamic symbols, glibc's own stdio buffers included, is counted for the
+// calling thread before going to glibc. Direct mmap() is not: the codec's
+// stage arena and mapped images show up in peak RSS rather than here.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void* __libc_valloc(size_t size);
+
+static __thread alloc_totals thread_allocs;
+
+static void count_alloc(size_t size) {
+    thread_allocs.bytes += size;
+    thread_allocs.count++;
+}
+
+void* malloc(size_t size) {
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    count_alloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    count_alloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+void* valloc(size_t size) {
+    count_alloc(size);
+    return __libc_valloc(size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) return EINVAL;
+    count_alloc(size);
+    void* p = __libc_memalign(alignment, size);
+    if (!p && size) return ENOMEM;
+    *out = p;
+    return 0;
+}
+
+static alloc_totals allocs_since(alloc_totals start) {
+    return (alloc_totals){ thread_allocs.bytes - start.bytes, thread_allocs.count - start.count };
+}
+
+typedef struct {
+    int width, height;
+    double load_time;
+    double encode_time;
+    double decode_time;
+    pp_stats stats;
+    uint64_t counters[PP_STAGE_COUNT][PERF_COUNTER_COUNT];
+    alloc_totals stage_allocs[PP_STAGE_COUNT];
+    alloc_totals encode_allocs, decode_allocs;    // whole calls, stages included
+    long encode_peak_rss, decode_peak_rss;        // bytes; -1 if not measured
+    long custom_size;
+    int verified;
+} custom_result;
+
+// Hardware counter and allocation deltas per stage, fed by the codec's
+// stage hook
+typedef struct {
+    perf_counters* pc;
+    uint64_t start[PERF_COUNTER_COUNT];
+    uint64_t (*totals)[PERF_COUNTER_COUNT];
+    alloc_totals alloc_start;
+    alloc_totals* allocs;
+} stage_probe;
+
+// Order statistics of one timing series
+typedef struct {
+    double median, p90, p99;
+    double ci_lo, ci_hi;    // ~95% confidence interval of the median
+} timing_summary;
+
+typedef struct {
+    int warmup, reps;
+    int pin_cpu;            // -1 = unpinned
+    int threads;            // corpus mode; 0 = one per CPU
+    int perf;               // collect hardware counters when permitted
+    int track_rss;          // peak RSS is process-wide, so single-threaded only
+    int effort;             // pp_preset() level for every encode
+} bench_options;
+
+// Everything one CSV row needs
+typedef struct {
+    const char* input;
+    int ok;
+    int width, height, channels;
+    long original_size;
+    custom_result custom;   // stage and total times are medians
+    timing_summary enc, dec, roundtrip;
+    long png_size;
+    double png_time;
+
+    // Median hardware counts per stage; counters_open is a bitmask of the
+    // counters that could be opened, 0 with perf_error set otherwise
+    double counters[PP_STAGE_COUNT][PERF_COUNTER_COUNT];
+    int counters_open;
+    const char* perf_error;
+} image_result;
+
+// Peak resident set (VmHWM) in bytes, or -1
+long peak_rss(void) {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb < 0 ? -1 : kb * 1024;
+}
+
+// Drops VmHWM to the current RSS so the next peak_rss() covers only what
+// runs in between. Returns 0 or -1 (kernels before 4.0).
+int reset_peak_rss(void) {
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (!f) return -1;
+    int ok = fputs("5", f) >= 0;
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
 // Get file size in bytes
 long get_file_size(const char* filename) {
     struct stat st;
@@ -28,190 +189,1366 @@ double get_time() {
     return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-// Run your compression algorithm
-int run_custom_compression(const char* input, const char* compressed, const char* decoded) {
-    char cmd[2048];
-    snprintf(cmd, sizeof(cmd), "./algo \"%s\" \"%s\" \"%s\"", input, compressed, decoded);
-    return system(cmd);
+// Raw RGB throughput in MB/s
+double mbps(double raw_bytes, double seconds) {
+    return seconds > 0 ? raw_bytes / seconds / 1e6 : 0;
 }
 
-// Convert image to PNG and return PNG size
-long convert_to_png(const char* input, const char* png_output) {
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Linear interpolation between closest ranks; v must be sorted
+double percentile(const double* v, int n, double p) {
+    double pos = p * (n - 1);
+    int i = (int)pos;
+    if (i + 1 >= n) return v[n - 1];
+    return v[i] + (pos - i) * (v[i + 1] - v[i]);
+}
+
+// Sorts v. The median's confidence interval uses the distribution-free
+// binomial ranks n/2 -+ 1.96*sqrt(n)/2, clamped to the sample.
+timing_summary summarize(double* v, int n) {
+    timing_summary t;
+    qsort(v, n, sizeof(double), compare_doubles);
+    t.median = percentile(v, n, 0.5);
+    t.p90 = percentile(v, n, 0.9);
+    t.p99 = percentile(v, n, 0.99);
+    double half = 1.96 * sqrt((double)n) / 2;
+    int lo = (int)floor(n / 2.0 - half);
+    int hi = (int)ceil(n / 2.0 + half);
+    t.ci_lo = v[lo < 0 ? 0 : lo];
+    t.ci_hi = v[hi > n - 1 ? n - 1 : hi];
+    return t;
+}
+
+// Compare two views pixel by pixel, whatever their row order and channel order
+int views_match(const image_view* a, const image_view* b) {
+    if (a->width != b->width || a->height != b->height) return 0;
+    for (int y = 0; y < a->height; y++) {
+        const unsigned char* ra = a->row0 + (ptrdiff_t)y * a->stride;
+        const unsigned char* rb = b->row0 + (ptrdiff_t)y * b->stride;
+        if (a->bgr == b->bgr) {
+            if (memcmp(ra, rb, (size_t)a->width * 3) != 0) return 0;
+            continue;
+        }
+        for (int x = 0; x < a->width; x++) {
+            if (ra[3*x] != rb[3*x + 2] || ra[3*x + 1] != rb[3*x + 1] || ra[3*x + 2] != rb[3*x]) return 0;
+        }
+    }
+    return 1;
+}
+
+// Run the codec in-process: load, encode to memory, decode from memory.
+// Stage times come from the codec's own pp_stats. For mapped BMP/PPM
+// input the pixels are paged in during "split", not "load".
+static void probe_stage(void* arg, pp_stage stage, int end) {
+    stage_probe* probe = arg;
+    if (!end) {
+        if (probe->pc) perf_read(probe->pc, probe->start);
+        probe->alloc_start = thread_allocs;
+        return;
+    }
+    alloc_totals delta = allocs_since(probe->alloc_start);
+    probe->allocs[stage].bytes += delta.bytes;
+    probe->allocs[stage].count += delta.count;
+
+    uint64_t now[PERF_COUNTER_COUNT];
+    if (!probe->pc || perf_read(probe->pc, now) != 0) return;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) probe->totals[stage][c] += now[c] - probe->start[c];
+}
+
+// pc may be NULL; otherwise its counters are read around every stage.
+// Peak RSS is measured only with track_rss.
+int run_custom_compression(pp_context* ctx, perf_counters* pc, int track_rss, int effort, const char* input,
+                           custom_result* r) {
+    memset(r, 0, sizeof(*r));
+    r->encode_peak_rss = r->decode_peak_rss = -1;
+    stage_probe probe = { pc, {0}, r->counters, {0, 0}, r->stage_allocs };
+    r->stats.hook = probe_stage;
+    r->stats.hook_arg = &probe;
+    pp_set_stats(ctx, &r->stats);
+
+    double start = get_time();
+    image_view img;
+    if (image_open(input, &img) != 0) {
+        fprintf(stderr, "Failed to load image: %s\n", image_failure_reason());
+        return -1;
+    }
+    r->load_time = get_time() - start;
+    r->width = img.width;
+    r->height = img.height;
+
+    // Encode
+    int rss = track_rss && reset_peak_rss() == 0;
+    alloc_totals alloc_start = thread_allocs;
+    char* compressed = NULL;
+    size_t compressed_len = 0;
+    FILE* mem = open_memstream(&compressed, &compressed_len);
+    start = get_time();
+    pp_options opts = pp_preset(effort);
+    int ret = mem ? pp_encode(ctx, &img, 0, &opts, mem, NULL) : -1;
+    if (mem && fclose(mem) != 0) ret = -1;
+    r->encode_time = get_time() - start;
+    r->custom_size = (long)compressed_len;
+    r->encode_allocs = allocs_since(alloc_start);
+    if (rss) r->encode_peak_rss = peak_rss();
+
+    // Decode into a plain RGB buffer
+    rss = rss && reset_peak_rss() == 0;
+    alloc_start = thread_allocs;
+    unsigned char* pixels = malloc((size_t)img.width * img.height * 3);
+    image_view out = { pixels, (ptrdiff_t)img.width * 3, img.width, img.height, 0, NULL, 0, NULL };
+    if (ret == 0 && pixels) {
+        FILE* in = fmemopen(compressed, compressed_len, "rb");
+        pp_header hdr;
+        start = get_time();
+        ret = in && pp_read_header(in, &hdr) == 0 ? pp_decode(ctx, in, &hdr, &out) : -1;
+        r->decode_time = get_time() - start;
+        if (in) fclose(in);
+        r->decode_allocs = allocs_since(alloc_start);
+        if (rss) r->decode_peak_rss = peak_rss();
+        r->verified = ret == 0 && views_match(&img, &out);
+    }
+
+    free(pixels);
+    free(compressed);
+    image_close(&img);
+    pp_set_stats(ctx, NULL);
+    return ret;
+}
+
+static void count_bytes(void* context, void* data, int size) {
+    (void)data;
+    *(long*)context += size;
+}
+
+// Encode image to PNG, counting bytes instead of writing them, and return PNG size
+long convert_to_png(const char* input) {
     int width, height, channels;
     unsigned char* img = stbi_load(input, &width, &height, &channels, 3);
-    
+
     if (!img) {
         fprintf(stderr, "Failed to load image for PNG conversion: %s\n", stbi_failure_reason());
         return -1;
     }
-    
-    // Write PNG
-    if (!stbi_write_png(png_output, width, height, 3, img, width * 3)) {
+
+    long png_size = 0;
+    int ok = stbi_write_png_to_func(count_bytes, &png_size, width, height, 3, img, width * 3);
+    stbi_image_free(img);
+    if (!ok) {
         fprintf(stderr, "Failed to write PNG\n");
-        stbi_image_free(img);
         return -1;
     }
-    
-    stbi_image_free(img);
-    
-    return get_file_size(png_output);
-}
-
-// Verify decoded image matches original
-int verify_images_match(const char* original, const char* decoded) {
-    int w1, h1, c1, w2, h2, c2;
-    unsigned char* img1 = stbi_load(original, &w1, &h1, &c1, 3);
-    unsigned char* img2 = stbi_load(decoded, &w2, &h2, &c2, 3);
-    
-    if (!img1 || !img2) {
-        if (img1) stbi_image_free(img1);
-        if (img2) stbi_image_free(img2);
-        return 0;
-    }
-    
-    if (w1 != w2 || h1 != h2) {
-        stbi_image_free(img1);
-        stbi_image_free(img2);
-        return 0;
-    }
-    
-    size_t size = w1 * h1 * 3;
-    int match = (memcmp(img1, img2, size) == 0);
-    
-    stbi_image_free(img1);
-    stbi_image_free(img2);
-    
-    return match;
+    return png_size;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <input_image> <output_csv>\n", argv[0]);
-        fprintf(stderr, "Example: %s static/image.bmp results.csv\n", argv[0]);
-        fprintf(stderr, "\nThis will:\n");
-        fprintf(stderr, "  1. Compress the image using your algorithm\n");
-        fprintf(stderr, "  2. Convert the original to PNG\n");
-        fprintf(stderr, "  3. Compare compression ratios\n");
-        fprintf(stderr, "  4. Append results to output CSV\n");
-        return 1;
-    }
-    
-    const char* input = argv[1];
-    const char* csv_output = argv[2];
-    
-    // Create temporary filenames
-    char compressed_file[512];
-    char decoded_file[512];
-    char png_file[512];
-    
-    snprintf(compressed_file, sizeof(compressed_file), "/tmp/benchmark_compressed_%ld.pp", (long)time(NULL));
-    snprintf(decoded_file, sizeof(decoded_file), "/tmp/benchmark_decoded_%ld.bmp", (long)time(NULL));
-    snprintf(png_file, sizeof(png_file), "/tmp/benchmark_png_%ld.png", (long)time(NULL));
-    
+int pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+// Warmup + timed runs of one image on a warm context, then PNG for comparison
+int benchmark_image(pp_context* ctx, const char* input, const bench_options* opt, image_result* res) {
+    memset(res, 0, sizeof(*res));
+    res->input = input;
+
     // Get original file size
-    long original_size = get_file_size(input);
-    if (original_size < 0) {
+    res->original_size = get_file_size(input);
+    if (res->original_size < 0) {
         fprintf(stderr, "Error: Cannot access input file: %s\n", input);
-        return 1;
+        return -1;
     }
-    
-    // Load image to get dimensions
-    int width, height, channels;
-    unsigned char* img = stbi_load(input, &width, &height, &channels, 0);
-    if (!img) {
-        fprintf(stderr, "Error: Cannot load image: %s\n", stbi_failure_reason());
-        return 1;
+
+    // Get dimensions without decoding
+    if (!stbi_info(input, &res->width, &res->height, &res->channels)) {
+        fprintf(stderr, "Error: Cannot load image %s: %s\n", input, stbi_failure_reason());
+        return -1;
     }
-    stbi_image_free(img);
-    
-    printf("Benchmarking: %s\n", input);
-    printf("Image dimensions: %dx%d, channels: %d\n", width, height, channels);
-    printf("Original file size: %ld bytes\n\n", original_size);
-    
-    // Run custom compression
-    printf("Running custom compression algorithm...\n");
-    double start = get_time();
-    int ret = run_custom_compression(input, compressed_file, decoded_file);
-    double end = get_time();
-    double custom_time = end - start;
-    
+
+    int warmup = opt->warmup, reps = opt->reps;
+    custom_result* runs = calloc(warmup + reps, sizeof(custom_result));
+    double* series = malloc(reps * sizeof(double));
+    if (!runs || !series) {
+        free(runs);
+        free(series);
+        return -1;
+    }
+    // Counters belong to the calling thread, so they are opened per image
+    perf_counters pc;
+    if (opt->perf && perf_open(&pc) > 0) {
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            if (perf_available(&pc, (perf_counter)c)) res->counters_open |= 1 << c;
+        }
+    } else {
+        res->perf_error = opt->perf ? perf_failure_reason() : "disabled";
+    }
+
+    int verification = 1, ret = 0;
+    for (int i = 0; i < warmup + reps && ret == 0; i++) {
+        ret = run_custom_compression(ctx, res->counters_open ? &pc : NULL, opt->track_rss, opt->effort, input,
+                                     &runs[i]);
+        verification &= runs[i].verified;
+    }
+    if (res->counters_open) perf_close(&pc);
     if (ret != 0) {
-        fprintf(stderr, "Error: Custom compression failed\n");
-        return 1;
+        fprintf(stderr, "Error: Custom compression failed: %s\n", input);
+        free(runs);
+        free(series);
+        return -1;
     }
-    
-    long custom_size = get_file_size(compressed_file);
-    if (custom_size < 0) {
-        fprintf(stderr, "Error: Cannot access compressed file\n");
-        return 1;
+
+    // Medians of the timed runs
+    custom_result* timed = runs + warmup;
+    res->custom = timed[0];
+    res->custom.verified = verification;
+    for (int i = 1; i < reps; i++) {
+        if (timed[i].encode_peak_rss > res->custom.encode_peak_rss) res->custom.encode_peak_rss = timed[i].encode_peak_rss;
+        if (timed[i].decode_peak_rss > res->custom.decode_peak_rss) res->custom.decode_peak_rss = timed[i].decode_peak_rss;
     }
-    
-    // Verify decompression
-    printf("Verifying decompression...\n");
-    int verification = verify_images_match(input, decoded_file);
-    if (!verification) {
-        fprintf(stderr, "Warning: Decoded image does not match original!\n");
+    for (int i = 0; i < reps; i++) series[i] = timed[i].load_time;
+    res->custom.load_time = summarize(series, reps).median;
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        for (int i = 0; i < reps; i++) series[i] = timed[i].stats.seconds[s];
+        res->custom.stats.seconds[s] = summarize(series, reps).median;
+        for (int c = 0; c < PERF_COUNTER_COUNT && res->counters_open; c++) {
+            for (int i = 0; i < reps; i++) series[i] = (double)timed[i].counters[s][c];
+            res->counters[s][c] = summarize(series, reps).median;
+        }
     }
-    
+    for (int i = 0; i < reps; i++) series[i] = timed[i].encode_time;
+    res->enc = summarize(series, reps);
+    for (int i = 0; i < reps; i++) series[i] = timed[i].decode_time;
+    res->dec = summarize(series, reps);
+    for (int i = 0; i < reps; i++) series[i] = timed[i].encode_time + timed[i].decode_time;
+    res->roundtrip = summarize(series, reps);
+    res->custom.encode_time = res->enc.median;
+    res->custom.decode_time = res->dec.median;
+    free(series);
+    free(runs);
+
     // Convert to PNG
-    printf("Converting to PNG for comparison...\n");
-    start = get_time();
-    long png_size = convert_to_png(input, png_file);
-    end = get_time();
-    double png_time = end - start;
-    
-    if (png_size < 0) {
-        fprintf(stderr, "Error: PNG conversion failed\n");
-        return 1;
+    double start = get_time();
+    res->png_size = convert_to_png(input);
+    res->png_time = get_time() - start;
+    if (res->png_size < 0) {
+        fprintf(stderr, "Error: PNG conversion failed: %s\n", input);
+        return -1;
+    }
+
+    res->ok = 1;
+    return 0;
+}
+
+double raw_bytes(const image_result* res) {
+    return (double)res->custom.width * res->custom.height * 3;
+}
+
+// Counter totals over the encode (decode = 0) or decode stages
+void sum_counters(const double counters[PP_STAGE_COUNT][PERF_COUNTER_COUNT], int decode,
+                  double out[PERF_COUNTER_COUNT]) {
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) out[c] = 0;
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        if ((s >= PP_STAGE_ENTROPY_DEC) != decode) continue;
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) out[c] += counters[s][c];
     }
-    
-    // Calculate metrics (as ratios, not percentages)
-    double custom_ratio = (double)custom_size / original_size;
-    double png_ratio = (double)png_size / original_size;
-    double relative_performance = (double)custom_size / png_size;
-    
-    // Print results
+}
+
+// IPC, then each miss counter per pixel; -1 where a counter is missing
+void derive_counters(const double v[PERF_COUNTER_COUNT], int open, double pixels, double out[4]) {
+    int both = (open & (1 << PERF_CYCLES)) && (open & (1 << PERF_INSTRUCTIONS)) && v[PERF_CYCLES] > 0;
+    out[0] = both ? v[PERF_INSTRUCTIONS] / v[PERF_CYCLES] : -1;
+    const perf_counter misses[3] = { PERF_BRANCH_MISSES, PERF_L1D_MISSES, PERF_LLC_MISSES };
+    for (int i = 0; i < 3; i++) out[i + 1] = open & (1 << misses[i]) ? v[misses[i]] / pixels : -1;
+}
+
+static void print_counter_row(const char* name, const double v[PERF_COUNTER_COUNT], int open, double pixels) {
+    double d[4];
+    derive_counters(v, open, pixels, d);
+    printf("  %-12s", name);
+    for (int i = 0; i < 4; i++) {
+        if (d[i] < 0) printf(" %10s", "-");
+        else printf(" %10.3f", d[i]);
+    }
+    printf("\n");
+}
+
+void print_counters(const image_result* res) {
+    if (!res->counters_open) {
+        printf("\n  Hardware counters: unavailable (%s)\n", res->perf_error);
+        return;
+    }
+    double pixels = (double)res->custom.width * res->custom.height;
+    printf("\n  %-12s %10s %10s %10s %10s\n", "Counters", "IPC", "br-miss/px", "L1d-miss/px", "LLC-miss/px");
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        print_counter_row(pp_stage_names[s], res->counters[s], res->counters_open, pixels);
+    }
+    double total[PERF_COUNTER_COUNT];
+    sum_counters(res->counters, 0, total);
+    print_counter_row("encode", total, res->counters_open, pixels);
+    sum_counters(res->counters, 1, total);
+    print_counter_row("decode", total, res->counters_open, pixels);
+}
+
+// Allocations per stage, whole-call totals and peak RSS per pixel
+void print_memory(const image_result* res) {
+    const custom_result* custom = &res->custom;
+    double pixels = (double)custom->width * custom->height;
+    printf("\n  %-12s %14s %10s\n", "Allocations", "Bytes", "Count");
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        printf("  %-12s %14llu %10llu\n", pp_stage_names[s],
+               (unsigned long long)custom->stage_allocs[s].bytes, (unsigned long long)custom->stage_allocs[s].count);
+    }
+    printf("  %-12s %14llu %10llu\n", "encode", (unsigned long long)custom->encode_allocs.bytes,
+           (unsigned long long)custom->encode_allocs.count);
+    printf("  %-12s %14llu %10llu\n", "decode", (unsigned long long)custom->decode_allocs.bytes,
+           (unsigned long long)custom->decode_allocs.count);
+    if (custom->encode_peak_rss < 0 || custom->decode_peak_rss < 0) {
+        printf("\n  Peak RSS: not measured\n");
+        return;
+    }
+    printf("\n  Peak RSS: encode %.1f MB (%.2f bytes/pixel), decode %.1f MB (%.2f bytes/pixel)\n",
+           custom->encode_peak_rss / 1e6, custom->encode_peak_rss / pixels,
+           custom->decode_peak_rss / 1e6, custom->decode_peak_rss / pixels);
+}
+
+void print_image_report(const image_result* res, int reps) {
+    const custom_result* custom = &res->custom;
+    double custom_ratio = (double)custom->custom_size / res->original_size;
+    double png_ratio = (double)res->png_size / res->original_size;
+    double relative_performance = (double)custom->custom_size / res->png_size;
+    double raw = raw_bytes(res);
+
     printf("\n=== RESULTS ===\n");
     printf("Custom Algorithm:\n");
-    printf("  Compressed size: %ld bytes (%.4fx of original)\n", custom_size, custom_ratio);
-    printf("  Time: %.6f seconds\n", custom_time);
-    printf("  Verification: %s\n", verification ? "PASS" : "FAIL");
+    printf("  Compressed size: %ld bytes (%.4fx of original)\n", custom->custom_size, custom_ratio);
+    printf("  Time: %.6f seconds (median of %d)\n", res->roundtrip.median, reps);
+    printf("  Verification: %s\n", custom->verified ? "PASS" : "FAIL");
+    printf("\n  %-12s %10s %10s %10s %23s\n", "Seconds", "median", "p90", "p99", "95% CI of median");
+    const timing_summary* rows[3] = { &res->enc, &res->dec, &res->roundtrip };
+    const char* row_names[3] = { "encode", "decode", "roundtrip" };
+    for (int i = 0; i < 3; i++) {
+        printf("  %-12s %10.6f %10.6f %10.6f   [%9.6f, %9.6f]\n", row_names[i],
+               rows[i]->median, rows[i]->p90, rows[i]->p99, rows[i]->ci_lo, rows[i]->ci_hi);
+    }
+    printf("\n  %-12s %10s %10s %14s %14s\n", "Stage", "Seconds", "MB/s", "Bytes in", "Bytes out");
+    printf("  %-12s %10.6f %10.1f\n", "load", custom->load_time, mbps(raw, custom->load_time));
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        printf("  %-12s %10.6f %10.1f %14llu %14llu\n", pp_stage_names[s], custom->stats.seconds[s],
+               mbps(raw, custom->stats.seconds[s]),
+               (unsigned long long)custom->stats.bytes_in[s], (unsigned long long)custom->stats.bytes_out[s]);
+    }
+    printf("  %-12s %10.6f %10.1f\n", "encode", custom->encode_time, mbps(raw, custom->encode_time));
+    printf("  %-12s %10.6f %10.1f\n", "decode", custom->decode_time, mbps(raw, custom->decode_time));
+    print_counters(res);
+    print_memory(res);
     printf("\nPNG Compression:\n");
-    printf("  Compressed size: %ld bytes (%.4fx of original)\n", png_size, png_ratio);
-    printf("  Time: %.6f seconds\n", png_time);
+    printf("  Compressed size: %ld bytes (%.4fx of original)\n", res->png_size, png_ratio);
+    printf("  Time: %.6f seconds\n", res->png_time);
     printf("\nComparison:\n");
-    printf("  Custom vs PNG: %.4fx (%s than PNG)\n", 
+    printf("  Custom vs PNG: %.4fx (%s than PNG)\n",
            relative_performance,
-           custom_size < png_size ? "better" : "worse");
-    printf("  Space difference: %ld bytes\n", png_size - custom_size);
-    
+           custom->custom_size < res->png_size ? "better" : "worse");
+    printf("  Space difference: %ld bytes\n", res->png_size - custom->custom_size);
+}
+
+void write_csv_header(FILE* csv) {
+    fprintf(csv, "filename,width,height,channels,original_bytes,custom_bytes,custom_ratio,custom_time,png_bytes,png_ratio,png_time,relative_performance,verified,load_mbps");
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        fprintf(csv, ",%s_mbps", pp_stage_names[s]);
+    }
+    fprintf(csv, ",encode_mbps,decode_mbps,reps,custom_time_p90,custom_time_p99,custom_time_ci_lo,custom_time_ci_hi");
+    fprintf(csv, ",encode_mbps_ci_lo,encode_mbps_ci_hi,decode_mbps_ci_lo,decode_mbps_ci_hi");
+    for (int decode = 0; decode < 2; decode++) {
+        const char* side = decode ? "decode" : "encode";
+        fprintf(csv, ",%s_ipc,%s_branch_misses_px,%s_l1d_misses_px,%s_llc_misses_px", side, side, side, side);
+    }
+    fprintf(csv, ",encode_peak_bytes_px,decode_peak_bytes_px,encode_alloc_bytes,encode_allocs,decode_alloc_bytes,decode_allocs\n");
+}
+
+// 1 if path is missing, empty or starts with write_csv_header()'s line, so
+// appended rows line up with the columns already there
+static int csv_header_matches(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return 1;
+    char line[8192];
+    int empty = !fgets(line, sizeof(line), f);
+    fclose(f);
+    if (empty) return 1;
+
+    char* expected = NULL;
+    size_t len = 0;
+    FILE* mem = open_memstream(&expected, &len);
+    if (!mem) return 0;
+    write_csv_header(mem);
+    fclose(mem);
+    line[strcspn(line, "\r\n")] = 0;
+    expected[strcspn(expected, "\r\n")] = 0;
+    int same = strcmp(line, expected) == 0;
+    free(expected);
+    return same;
+}
+
+// Encode then decode IPC and misses per pixel; empty where unavailable
+static void write_csv_counters(FILE* csv, const double counters[PP_STAGE_COUNT][PERF_COUNTER_COUNT],
+                               int open, double pixels) {
+    for (int decode = 0; decode < 2; decode++) {
+        double total[PERF_COUNTER_COUNT], d[4];
+        sum_counters(counters, decode, total);
+        derive_counters(total, open, pixels, d);
+        for (int i = 0; i < 4; i++) {
+            if (d[i] < 0) fprintf(csv, ",");
+            else fprintf(csv, ",%.4f", d[i]);
+        }
+    }
+}
+
+// Peak RSS per pixel (empty when not measured), then allocation totals:
+// heap calls seen by the allocation hook, not the arena or image mappings
+static void write_csv_memory(FILE* csv, double encode_peak, double decode_peak, double pixels,
+                             const alloc_totals* enc, const alloc_totals* dec) {
+    if (encode_peak < 0 || decode_peak < 0 || pixels <= 0) fprintf(csv, ",,");
+    else fprintf(csv, ",%.3f,%.3f", encode_peak / pixels, decode_peak / pixels);
+    fprintf(csv, ",%llu,%llu,%llu,%llu\n", (unsigned long long)enc->bytes, (unsigned long long)enc->count,
+            (unsigned long long)dec->bytes, (unsigned long long)dec->count);
+}
+
+// Throughput is raw RGB bytes per second for every stage, so stages compare directly
+void write_csv_row(FILE* csv, const image_result* res, int reps) {
+    const custom_result* custom = &res->custom;
+    double raw = raw_bytes(res);
+    fprintf(csv, "%s,%d,%d,%d,%ld,%ld,%.6f,%.6f,%ld,%.6f,%.6f,%.6f,%s,%.3f",
+            res->input, res->width, res->height, res->channels, res->original_size,
+            custom->custom_size, (double)custom->custom_size / res->original_size, res->roundtrip.median,
+            res->png_size, (double)res->png_size / res->original_size, res->png_time,
+            (double)custom->custom_size / res->png_size, custom->verified ? "yes" : "no",
+            mbps(raw, custom->load_time));
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        fprintf(csv, ",%.3f", mbps(raw, custom->stats.seconds[s]));
+    }
+    fprintf(csv, ",%.3f,%.3f,%d,%.6f,%.6f,%.6f,%.6f", mbps(raw, custom->encode_time), mbps(raw, custom->decode_time),
+            reps, res->roundtrip.p90, res->roundtrip.p99, res->roundtrip.ci_lo, res->roundtrip.ci_hi);
+    // The slow end of the time interval is the low end in MB/s
+    fprintf(csv, ",%.3f,%.3f,%.3f,%.3f", mbps(raw, res->enc.ci_hi), mbps(raw, res->enc.ci_lo),
+            mbps(raw, res->dec.ci_hi), mbps(raw, res->dec.ci_lo));
+    double pixels = (double)custom->width * custom->height;
+    write_csv_counters(csv, res->counters, res->counters_open, pixels);
+    write_csv_memory(csv, custom->encode_peak_rss, custom->decode_peak_rss, pixels,
+                     &custom->encode_allocs, &custom->decode_allocs);
+}
+
+// One "(aggregate)" row over every successful image: sizes and times are
+// totals, the two ratio columns are geometric means, relative_performance
+// is total custom bytes / total PNG bytes, and MB/s is total raw bytes over
+// total time. Peak bytes per pixel is the worst image's.
+void write_csv_aggregate(FILE* csv, const image_result* results, int n, int reps) {
+    long original = 0, custom_bytes = 0, png_bytes = 0;
+    double raw = 0, load = 0, roundtrip = 0, png_time = 0, enc = 0, dec = 0;
+    double stage[PP_STAGE_COUNT] = {0};
+    double log_custom = 0, log_png = 0;
+    double counters[PP_STAGE_COUNT][PERF_COUNTER_COUNT] = {{0}}, counted_pixels = 0;
+    int count = 0, verified = 1, counters_open = -1;
+    double encode_peak_px = 0, decode_peak_px = 0;
+    alloc_totals enc_allocs = {0, 0}, dec_allocs = {0, 0};
+    for (int i = 0; i < n; i++) {
+        const image_result* res = &results[i];
+        if (!res->ok) continue;
+        count++;
+        original += res->original_size;
+        custom_bytes += res->custom.custom_size;
+        png_bytes += res->png_size;
+        log_custom += log((double)res->custom.custom_size / res->original_size);
+        log_png += log((double)res->png_size / res->original_size);
+        raw += raw_bytes(res);
+        load += res->custom.load_time;
+        roundtrip += res->roundtrip.median;
+        png_time += res->png_time;
+        enc += res->custom.encode_time;
+        dec += res->custom.decode_time;
+        for (int s = 0; s < PP_STAGE_COUNT; s++) stage[s] += res->custom.stats.seconds[s];
+        verified &= res->custom.verified;
+        enc_allocs.bytes += res->custom.encode_allocs.bytes;
+        enc_allocs.count += res->custom.encode_allocs.count;
+        dec_allocs.bytes += res->custom.decode_allocs.bytes;
+        dec_allocs.count += res->custom.decode_allocs.count;
+        double px = raw_bytes(res) / 3;
+        if (res->custom.encode_peak_rss < 0) encode_peak_px = -1;
+        else if (encode_peak_px >= 0 && res->custom.encode_peak_rss / px > encode_peak_px) encode_peak_px = res->custom.encode_peak_rss / px;
+        if (res->custom.decode_peak_rss < 0) decode_peak_px = -1;
+        else if (decode_peak_px >= 0 && res->custom.decode_peak_rss / px > decode_peak_px) decode_peak_px = res->custom.decode_peak_rss / px;
+
+        // Counters only over images that had them, per pixel of those images
+        if (!res->counters_open) continue;
+        counters_open &= res->counters_open;
+        counted_pixels += raw_bytes(res) / 3;
+        for (int s = 0; s < PP_STAGE_COUNT; s++) {
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++) counters[s][c] += res->counters[s][c];
+        }
+    }
+    if (count == 0) return;
+    if (counted_pixels == 0) counters_open = 0;
+
+    double geo_custom = exp(log_custom / count), geo_png = exp(log_png / count);
+    double weighted = (double)custom_bytes / png_bytes;
+    fprintf(csv, "(aggregate),,,,%ld,%ld,%.6f,%.6f,%ld,%.6f,%.6f,%.6f,%s,%.3f",
+            original, custom_bytes, geo_custom, roundtrip, png_bytes, geo_png, png_time,
+            weighted, verified ? "yes" : "no", mbps(raw, load));
+    for (int s = 0; s < PP_STAGE_COUNT; s++) {
+        fprintf(csv, ",%.3f", mbps(raw, stage[s]));
+    }
+    fprintf(csv, ",%.3f,%.3f,%d,,,,,,,,", mbps(raw, enc), mbps(raw, dec), reps);
+    write_csv_counters(csv, counters, counters_open, counted_pixels);
+    write_csv_memory(csv, encode_peak_px, decode_peak_px, 1, &enc_allocs, &dec_allocs);
+
+    printf("\n=== CORPUS (%d of %d images) ===\n", count, n);
+    printf("  Geometric-mean ratio: %.4f (PNG %.4f)\n", geo_custom, geo_png);
+    printf("  Weighted ratio vs PNG: %.4f (%ld vs %ld bytes)\n", weighted, custom_bytes, png_bytes);
+    printf("  Throughput: %.2f MB/s encode, %.2f MB/s decode, %.2f MB/s roundtrip\n",
+           mbps(raw, enc), mbps(raw, dec), mbps(raw, roundtrip));
+    printf("  Verification: %s\n", verified ? "PASS" : "FAIL");
+    if (counters_open) {
+        double total[PERF_COUNTER_COUNT];
+        printf("\n  %-12s %10s %10s %10s %10s\n", "Counters", "IPC", "br-miss/px", "L1d-miss/px", "LLC-miss/px");
+        sum_counters(counters, 0, total);
+        print_counter_row("encode", total, counters_open, counted_pixels);
+        sum_counters(counters, 1, total);
+        print_counter_row("decode", total, counters_open, counted_pixels);
+    } else {
+        printf("  Hardware counters: unavailable\n");
+    }
+}
+
+typedef struct {
+    const char** inputs;
+    image_result* results;
+    pp_context** contexts;      // one per worker
+    int* pinned;                // per worker
+    const bench_options* opt;
+    int index;
+} corpus_task;
+
+static void run_corpus_task(void* arg, int worker) {
+    corpus_task* t = arg;
+    const bench_options* opt = t->opt;
+    if (opt->pin_cpu >= 0 && !t->pinned[worker]) {
+        t->pinned[worker] = 1;
+        pin_to_cpu(opt->pin_cpu + worker);
+    }
+
+    image_result* res = &t->results[t->index];
+    if (benchmark_image(t->contexts[worker], t->inputs[t->index], opt, res) == 0) {
+        printf("%s: %.4fx of original, %.4fx of PNG, %.2f MB/s roundtrip, %s\n", res->input,
+               (double)res->custom.custom_size / res->original_size,
+               (double)res->custom.custom_size / res->png_size,
+               mbps(raw_bytes(res), res->roundtrip.median), res->custom.verified ? "PASS" : "FAIL");
+    }
+}
+
+// Reads one path per line; blank lines and '#' comments are skipped
+char** read_manifest(const char* path, int* count) {
+    FILE* f = fopen(path, "r");
+    if (!f) return NULL;
+    char** list = NULL;
+    int n = 0, cap = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (!line[0] || line[0] == '#') continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            list = realloc(list, cap * sizeof(char*));
+        }
+        list[n++] = strdup(line);
+    }
+    fclose(f);
+    *count = n;
+    return list;
+}
+
+// Runs every input concurrently and rewrites csv_output with one row per
+// image plus the aggregate row. Everything happens in memory, so
+// concurrent runs never share temporary files. Returns the number of
+// images that failed.
+int run_corpus(char** inputs, int n, const char* csv_output, const bench_options* options) {
+    pool* p = pool_create(options->threads);
+    if (!p) return n;
+    int nworkers = pool_threads(p);
+    bench_options corpus_opt = *options;
+    corpus_opt.track_rss = options->track_rss && nworkers == 1;
+    const bench_options* opt = &corpus_opt;
+    printf("Benchmarking %d images on %d threads (%d warmup, %d timed)...\n",
+           n, nworkers, opt->warmup, opt->reps);
+
+    image_result* results = calloc(n, sizeof(image_result));
+    corpus_task* tasks = calloc(n, sizeof(corpus_task));
+    pp_context** contexts = calloc(nworkers, sizeof(pp_context*));
+    int* pinned = calloc(nworkers, sizeof(int));
+    for (int i = 0; i < nworkers; i++) contexts[i] = pp_context_create(0);
+    for (int i = 0; i < n; i++) {
+        tasks[i] = (corpus_task){ (const char**)inputs, results, contexts, pinned, opt, i };
+        pool_submit(p, run_corpus_task, &tasks[i]);
+    }
+    pool_wait(p);
+    pool_destroy(p);
+
+    int failed = 0;
+    FILE* csv = fopen(csv_output, "w");
+    if (!csv) {
+        fprintf(stderr, "Error: Cannot open output CSV file\n");
+        failed = n;
+    } else {
+        write_csv_header(csv);
+        for (int i = 0; i < n; i++) {
+            if (results[i].ok) write_csv_row(csv, &results[i], opt->reps);
+            else failed++;
+        }
+        write_csv_aggregate(csv, results, n, opt->reps);
+        fclose(csv);
+        printf("\nResults written to: %s\n", csv_output);
+    }
+
+    for (int i = 0; i < nworkers; i++) pp_context_free(contexts[i]);
+    free(results);
+    free(tasks);
+    free(contexts);
+    free(pinned);
+    return failed;
+}
+
+void free_list(char** list, int n) {
+    for (int i = 0; i < n; i++) free(list[i]);
+    free(list);
+}
+
+// A results CSV held as strings, looked up by column name so baselines
+// written before a column existed still compare on the columns they have
+typedef struct {
+    char** names;
+    int ncols;
+    char*** rows;
+    int nrows;
+} csv_table;
+
+static char** split_csv_line(char* line, int* count) {
+    char** fields = NULL;
+    int n = 0;
+    line[strcspn(line, "\r\n")] = 0;
+    for (char* field = line;; ) {
+        char* comma = strchr(field, ',');
+        if (comma) *comma = 0;
+        fields = realloc(fields, (n + 1) * sizeof(char*));
+        fields[n++] = strdup(field);
+        if (!comma) break;
+        field = comma + 1;
+    }
+    *count = n;
+    return fields;
+}
+
+int read_csv(const char* path, csv_table* t) {
+    memset(t, 0, sizeof(*t));
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    char line[8192];
+    if (!fgets(line, sizeof(line), f)) {
+        fclose(f);
+        return -1;
+    }
+    t->names = split_csv_line(line, &t->ncols);
+    for (int lineno = 2; fgets(line, sizeof(line), f); lineno++) {
+        if (line[0] == '\n' || line[0] == 0) continue;
+        int n;
+        char** fields = split_csv_line(line, &n);
+        if (n != t->ncols) {
+            fprintf(stderr, "Warning: %s:%d has %d fields, the header %d; row skipped\n", path, lineno, n, t->ncols);
+            free_list(fields, n);
+            continue;
+        }
+        t->rows = realloc(t->rows, (t->nrows + 1) * sizeof(char**));
+        t->rows[t->nrows++] = fields;
+    }
+    fclose(f);
+    return 0;
+}
+
+void free_csv(csv_table* t) {
+    for (int r = 0; r < t->nrows; r++) free_list(t->rows[r], t->ncols);
+    free(t->rows);
+    free_list(t->names, t->ncols);
+}
+
+int csv_column(const csv_table* t, const char* name) {
+    for (int c = 0; c < t->ncols; c++) {
+        if (strcmp(t->names[c], name) == 0) return c;
+    }
+    return -1;
+}
+
+const char* csv_field(const csv_table* t, const char* filename, const char* column) {
+    int c = csv_column(t, column);
+    if (c < 0) return NULL;
+    for (int r = 0; r < t->nrows; r++) {
+        if (strcmp(t->rows[r][0], filename) == 0) return t->rows[r][c];
+    }
+    return NULL;
+}
+
+// Skips "(aggregate)" rows and hand-added summary rows with no filename
+static int is_image_row(const char* name) {
+    return name[0] && name[0] != '(';
+}
+
+// Relative change of `column` for one image in percent, positive = larger
+static int delta_pct(const csv_table* base, const csv_table* cur, const char* filename,
+                     const char* column, double* pct) {
+    const char* b = csv_field(base, filename, column);
+    const char* c = csv_field(cur, filename, column);
+    if (!b || !c || !*b || !*c) return 0;
+    double bv = atof(b), cv = atof(c);
+    if (bv <= 0) return 0;
+    *pct = (cv - bv) / bv * 100.0;
+    return 1;
+}
+
+// 1 if both rows have the interval columns lo and hi and the fresh
+// interval lies wholly on the bad side of the baseline's: below it for
+// MB/s (higher_is_better), above it for times
+static int interval_worse(const csv_table* base, const csv_table* cur, const char* filename,
+                          const char* lo, const char* hi, int higher_is_better) {
+    const char* b_lo = csv_field(base, filename, lo);
+    const char* b_hi = csv_field(base, filename, hi);
+    const char* c_lo = csv_field(cur, filename, lo);
+    const char* c_hi = csv_field(cur, filename, hi);
+    if (!b_lo || !b_hi || !c_lo || !c_hi || !*b_lo || !*b_hi || !*c_lo || !*c_hi) return -1;
+    return higher_is_better ? atof(c_hi) < atof(b_lo) : atof(c_lo) > atof(b_hi);
+}
+
+// Share of the baseline's roundtrip time spent in one stage, or 0
+static double stage_share(const csv_table* base, const char* filename, const char* column) {
+    const char* w = csv_field(base, filename, "width");
+    const char* h = csv_field(base, filename, "height");
+    const char* v = csv_field(base, filename, column);
+    const char* t = csv_field(base, filename, "custom_time");
+    if (!w || !h || !v || !t || atof(v) <= 0 || atof(t) <= 0) return 0;
+    double stage_s = (double)atoi(w) * atoi(h) * 3 / 1e6 / atof(v);
+    return stage_s / atof(t);
+}
+
+// Compares every image in the baseline against the fresh run. Compressed
+// size may grow by at most size_tol percent. Speed is gated on the total
+// encode_mbps and decode_mbps, and on stages taking at least
+// MIN_STAGE_SHARE of the roundtrip: a drop counts only past speed_tol and
+// when the fresh median interval (the *_ci_* columns) lies wholly below
+// the baseline's. A stage, having no interval of its own, also needs its
+// side (encode or decode) to have moved that way. Baselines without those
+// columns fall back to custom_time and its interval. Speed is only gated
+// on images of at least MIN_GATED_PIXELS. Returns the number of regressed
+// images.
+int compare_results(const csv_table* base, const csv_table* cur, double size_tol, double speed_tol) {
+    printf("\n=== COMPARISON (size +%.2f%%, speed -%.1f%% allowed) ===\n", size_tol, speed_tol);
+    printf("%-32s %9s %9s %9s %9s  %-20s %s\n", "image", "bytes", "time", "encode", "decode",
+           "worst stage", "status");
+
+    int totals = csv_column(base, "encode_mbps") >= 0 && csv_column(cur, "encode_mbps") >= 0;
+    int regressed = 0;
+    for (int r = 0; r < base->nrows; r++) {
+        const char* name = base->rows[r][0];
+        if (!is_image_row(name)) continue;
+        char reason[128] = "";
+
+        const char* verified = csv_field(cur, name, "verified");
+        if (!verified) {
+            printf("%-32s %9s %9s %9s %9s  %-20s %s\n", name, "-", "-", "-", "-", "-", "FAILED");
+            regressed++;
+            continue;
+        }
+
+        double bytes = 0, time = 0, enc = 0, dec = 0;
+        int has_bytes = delta_pct(base, cur, name, "custom_bytes", &bytes);
+        int has_time = delta_pct(base, cur, name, "custom_time", &time);
+        int has_enc = delta_pct(base, cur, name, "encode_mbps", &enc);
+        int has_dec = delta_pct(base, cur, name, "decode_mbps", &dec);
+
+        // A missing interval (older files) leaves the tolerance alone to decide
+        int enc_worse = interval_worse(base, cur, name, "encode_mbps_ci_lo", "encode_mbps_ci_hi", 1) != 0;
+        int dec_worse = interval_worse(base, cur, name, "decode_mbps_ci_lo", "decode_mbps_ci_hi", 1) != 0;
+        int time_worse = interval_worse(base, cur, name, "custom_time_ci_lo", "custom_time_ci_hi", 0) != 0;
+
+        const char* worst = "-";
+        double worst_pct = 0;
+        for (int s = 0; s < PP_STAGE_COUNT; s++) {
+            char col[64];
+            snprintf(col, sizeof(col), "%s_mbps", pp_stage_names[s]);
+            double pct;
+            if (stage_share(base, name, col) < MIN_STAGE_SHARE) continue;
+            if (!(s < PP_STAGE_ENTROPY_DEC ? enc_worse : dec_worse)) continue;
+            if (delta_pct(base, cur, name, col, &pct) && pct < worst_pct) {
+                worst_pct = pct;
+                worst = pp_stage_names[s];
+            }
+        }
+
+        const char* w = csv_field(base, name, "width");
+        const char* h = csv_field(base, name, "height");
+        int gated = w && h && (double)atoi(w) * atoi(h) >= MIN_GATED_PIXELS;
+
+        if (strcmp(verified, "yes") != 0) {
+            snprintf(reason, sizeof(reason), "not verified");
+        } else if (has_bytes && bytes > size_tol) {
+            snprintf(reason, sizeof(reason), "size +%.2f%%", bytes);
+        } else if (gated && totals && has_enc && -enc > speed_tol && enc_worse) {
+            snprintf(reason, sizeof(reason), "encode %.1f%%", enc);
+        } else if (gated && totals && has_dec && -dec > speed_tol && dec_worse) {
+            snprintf(reason, sizeof(reason), "decode %.1f%%", dec);
+        } else if (gated && totals && -worst_pct > speed_tol) {
+            snprintf(reason, sizeof(reason), "%s %.1f%%", worst, worst_pct);
+        } else if (gated && !totals && has_time && time > speed_tol && time_worse) {
+            snprintf(reason, sizeof(reason), "time +%.1f%%", time);
+        }
+
+        char stage[32] = "-";
+        if (worst_pct < 0) snprintf(stage, sizeof(stage), "%s %+.1f%%", worst, worst_pct);
+        printf("%-32s %+8.2f%% %+8.1f%% %+8.1f%% %+8.1f%%  %-20s %s\n", name,
+               has_bytes ? bytes : 0.0, has_time ? time : 0.0, has_enc ? enc : 0.0, has_dec ? dec : 0.0,
+               stage, reason[0] ? "REGRESSED" : gated ? "ok" : "ok (size only)");
+        if (reason[0]) {
+            printf("    %s\n", reason);
+            regressed++;
+        }
+    }
+    return regressed;
+}
+
+// Reruns every image named in the baseline, writes the fresh results to
+// csv_output and gates them against the baseline
+int run_compare(const char* baseline, const char* csv_output, const bench_options* opt,
+                double size_tol, double speed_tol) {
+    csv_table base;
+    if (read_csv(baseline, &base) != 0 || base.nrows == 0 || strcmp(base.names[0], "filename") != 0) {
+        fprintf(stderr, "Error: Cannot read baseline: %s\n", baseline);
+        return 1;
+    }
+
+    char** inputs = malloc(base.nrows * sizeof(char*));
+    int n = 0;
+    for (int r = 0; r < base.nrows; r++) {
+        if (is_image_row(base.rows[r][0])) inputs[n++] = strdup(base.rows[r][0]);
+    }
+    // One image at a time: concurrent images share caches and memory
+    // bandwidth, and that noise alone would trip the gate
+    bench_options serial = *opt;
+    serial.threads = 1;
+    run_corpus(inputs, n, csv_output, &serial);
+    free_list(inputs, n);
+
+    csv_table cur;
+    if (read_csv(csv_output, &cur) != 0) {
+        fprintf(stderr, "Error: Cannot read results: %s\n", csv_output);
+        free_csv(&base);
+        return 1;
+    }
+    int regressed = compare_results(&base, &cur, size_tol, speed_tol);
+    free_csv(&cur);
+    free_csv(&base);
+
+    if (regressed) {
+        printf("\n%d of %d images regressed against %s\n", regressed, n, baseline);
+        return 2;
+    }
+    printf("\nNo regressions against %s\n", baseline);
+    return 0;
+}
+
+typedef struct {
+    image_view img;
+    char* compressed;
+    size_t compressed_len;
+} scaling_input;
+
+typedef struct {
+    scaling_input* input;
+    pp_context** contexts;
+    int* pinned;
+    int pin_cpu;
+    int effort;
+    int decode;
+    int failed;
+} scaling_task;
+
+static void run_scaling_task(void* arg, int worker) {
+    scaling_task* t = arg;
+    if (t->pin_cpu >= 0 && !t->pinned[worker]) {
+        t->pinned[worker] = 1;
+        pin_to_cpu(t->pin_cpu + worker);
+    }
+
+    scaling_input* in = t->input;
+    pp_context* ctx = t->contexts[worker];
+    if (!t->decode) {
+        char* buf = NULL;
+        size_t len = 0;
+        FILE* mem = open_memstream(&buf, &len);
+        pp_options opts = pp_preset(t->effort);
+        t->failed = !mem || pp_encode(ctx, &in->img, 0, &opts, mem, NULL) != 0;
+        if (mem && fclose(mem) != 0) t->failed = 1;
+        free(buf);
+        return;
+    }
+
+    int w = in->img.width, h = in->img.height;
+    unsigned char* pixels = malloc((size_t)w * h * 3);
+    image_view out = { pixels, (ptrdiff_t)w * 3, w, h, 0, NULL, 0, NULL };
+    FILE* f = pixels ? fmemopen(in->compressed, in->compressed_len, "rb") : NULL;
+    pp_header hdr;
+    t->failed = !f || pp_read_header(f, &hdr) != 0 || pp_decode(ctx, f, &hdr, &out) != 0;
+    if (f) fclose(f);
+    free(pixels);
+}
+
+// Wall time for every input coded once on `threads` workers, median of reps
+static double time_scaling_pass(scaling_input* inputs, int n, int threads, int decode,
+                                pp_context** contexts, const bench_options* opt) {
+    double* times = malloc(opt->reps * sizeof(double));
+    scaling_task* tasks = calloc(n, sizeof(scaling_task));
+    int* pinned = calloc(threads, sizeof(int));
+    pool* p = pool_create(threads);
+    int failed = !times || !tasks || !pinned || !p;
+
+    for (int r = -opt->warmup; r < opt->reps && !failed; r++) {
+        double start = get_time();
+        for (int i = 0; i < n; i++) {
+            tasks[i] = (scaling_task){ &inputs[i], contexts, pinned, opt->pin_cpu, opt->effort, decode, 0 };
+            pool_submit(p, run_scaling_task, &tasks[i]);
+        }
+        pool_wait(p);
+        if (r >= 0) times[r] = get_time() - start;
+        for (int i = 0; i < n; i++) failed |= tasks[i].failed;
+    }
+    double seconds = failed ? -1 : summarize(times, opt->reps).median;
+
+    if (p) pool_destroy(p);
+    free(pinned);
+    free(tasks);
+    free(times);
+    return seconds;
+}
+
+// Encodes and decodes the whole input set at 1, 2, 4, ... max_threads
+// workers (plus max_threads itself) and reports speedup and efficiency
+// against one worker. Work is split per image, the unit batch mode and
+// the daemon parallelise over, so the set should hold several images per
+// thread.
+int run_scaling(char** paths, int n, const char* csv_output, const bench_options* opt) {
+    int max_threads = opt->threads > 0 ? opt->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    scaling_input* inputs = calloc(n, sizeof(scaling_input));
+    pp_context** contexts = calloc(max_threads, sizeof(pp_context*));
+    if (!inputs || !contexts) return 1;
+    for (int i = 0; i < max_threads; i++) contexts[i] = pp_context_create(0);
+
+    // Decode inputs are encoded once up front, outside any timing
+    int ret = 0;
+    double raw = 0;
+    for (int i = 0; i < n && ret == 0; i++) {
+        if (image_open(paths[i], &inputs[i].img) != 0) {
+            fprintf(stderr, "Error: Cannot load image %s: %s\n", paths[i], image_failure_reason());
+            ret = 1;
+            break;
+        }
+        raw += (double)inputs[i].img.width * inputs[i].img.height * 3;
+        FILE* mem = open_memstream(&inputs[i].compressed, &inputs[i].compressed_len);
+        pp_options opts = pp_preset(opt->effort);
+        if (!mem || pp_encode(contexts[0], &inputs[i].img, 0, &opts, mem, NULL) != 0) ret = 1;
+        if (mem && fclose(mem) != 0) ret = 1;
+        if (ret) fprintf(stderr, "Error: Custom compression failed: %s\n", paths[i]);
+    }
+
+    FILE* csv = NULL;
+    if (ret == 0) {
+        csv = fopen(csv_output, "w");
+        if (!csv) {
+            fprintf(stderr, "Error: Cannot open output CSV file\n");
+            ret = 1;
+        }
+    }
+    if (ret == 0) {
+        printf("Scaling over %d images (%.1f MB raw), 1..%d threads, %d warmup, %d timed\n",
+               n, raw / 1e6, max_threads, opt->warmup, opt->reps);
+        if (n < max_threads) printf("Note: fewer images than threads; work is split per image\n");
+        printf("\n%8s %10s %10s %8s %8s %10s %10s %8s %8s\n", "threads", "enc s", "enc MB/s", "speedup",
+               "eff", "dec s", "dec MB/s", "speedup", "eff");
+        fprintf(csv, "threads,images,raw_bytes,encode_seconds,encode_mbps,encode_speedup,encode_efficiency,"
+                     "decode_seconds,decode_mbps,decode_speedup,decode_efficiency\n");
+
+        double base[2] = { 0, 0 };
+        for (int t = 1; ret == 0; t = t * 2 > max_threads && t < max_threads ? max_threads : t * 2) {
+            double sec[2];
+            for (int decode = 0; decode < 2; decode++) {
+                sec[decode] = time_scaling_pass(inputs, n, t, decode, contexts, opt);
+                if (sec[decode] < 0) ret = 1;
+                if (t == 1) base[decode] = sec[decode];
+            }
+            if (ret) {
+                fprintf(stderr, "Error: Coding failed at %d threads\n", t);
+                break;
+            }
+            double speedup[2] = { base[0] / sec[0], base[1] / sec[1] };
+            printf("%8d %10.4f %10.1f %7.2fx %7.0f%% %10.4f %10.1f %7.2fx %7.0f%%\n", t,
+                   sec[0], mbps(raw, sec[0]), speedup[0], 100 * speedup[0] / t,
+                   sec[1], mbps(raw, sec[1]), speedup[1], 100 * speedup[1] / t);
+            fprintf(csv, "%d,%d,%.0f,%.6f,%.3f,%.4f,%.4f,%.6f,%.3f,%.4f,%.4f\n", t, n, raw,
+                    sec[0], mbps(raw, sec[0]), speedup[0], speedup[0] / t,
+                    sec[1], mbps(raw, sec[1]), speedup[1], speedup[1] / t);
+            if (t >= max_threads) break;
+        }
+        printf("\nResults written to: %s\n", csv_output);
+    }
+
+    if (csv) fclose(csv);
+    for (int i = 0; i < n; i++) {
+        image_close(&inputs[i].img);
+        free(inputs[i].compressed);
+    }
+    for (int i = 0; i < max_threads; i++) pp_context_free(contexts[i]);
+    free(inputs);
+    free(contexts);
+    return ret;
+}
+
+typedef struct {
+    uint64_t bytes;
+    double bpp;
+    double encode_mbps, decode_mbps, roundtrip_mbps;
+    int pareto;
+} preset_point;
+
+// Codes every input once per rep with one preset; median totals over reps
+static int time_preset(scaling_input* inputs, char** paths, int n, double raw, int effort, pp_context* ctx,
+                       const bench_options* opt, preset_point* pt) {
+    double* enc = malloc(opt->reps * sizeof(double));
+    double* dec = malloc(opt->reps * sizeof(double));
+    pp_options opts = pp_preset(effort);
+    int ret = enc && dec ? 0 : -1;
+    for (int r = -opt->warmup; r < opt->reps && ret == 0; r++) {
+        double enc_s = 0, dec_s = 0;
+        pt->bytes = 0;
+        for (int i = 0; i < n && ret == 0; i++) {
+            scaling_input* in = &inputs[i];
+            free(in->compressed);
+            in->compressed = NULL;
+            FILE* mem = open_memstream(&in->compressed, &in->compressed_len);
+            double start = get_time();
+            if (!mem || pp_encode(ctx, &in->img, 0, &opts, mem, NULL) != 0) ret = -1;
+            if (mem && fclose(mem) != 0) ret = -1;
+            enc_s += get_time() - start;
+            pt->bytes += in->compressed_len;
+
+            int w = in->img.width, h = in->img.height;
+            unsigned char* pixels = malloc((size_t)w * h * 3);
+            image_view out = { pixels, (ptrdiff_t)w * 3, w, h, 0, NULL, 0, NULL };
+            FILE* f = pixels && ret == 0 ? fmemopen(in->compressed, in->compressed_len, "rb") : NULL;
+            pp_header hdr;
+            start = get_time();
+            if (!f || pp_read_header(f, &hdr) != 0 || pp_decode(ctx, f, &hdr, &out) != 0) ret = -1;
+            dec_s += get_time() - start;
+            if (f) fclose(f);
+            if (ret == 0 && !views_match(&in->img, &out)) ret = -1;
+            free(pixels);
+            if (ret != 0) fprintf(stderr, "Error: %s does not round-trip\n", paths[i]);
+        }
+        if (r >= 0) {
+            enc[r] = enc_s;
+            dec[r] = dec_s;
+        }
+    }
+    if (ret == 0) {
+        double enc_s = summarize(enc, opt->reps).median, dec_s = summarize(dec, opt->reps).median;
+        pt->bpp = pt->bytes * 8.0 / (raw / 3);
+        pt->encode_mbps = mbps(raw, enc_s);
+        pt->decode_mbps = mbps(raw, dec_s);
+        pt->roundtrip_mbps = mbps(raw, enc_s + dec_s);
+    }
+    free(enc);
+    free(dec);
+    return ret;
+}
+
+// Text scatter of roundtrip MB/s (log scale) against bits per pixel, each
+// preset drawn as its effort digit (the lowest wins where points overlap)
+static void plot_presets(const preset_point* pts) {
+    enum { COLS = 60, ROWS = 14 };
+    double x0 = pts[0].bpp, x1 = x0, y0 = pts[0].roundtrip_mbps, y1 = y0;
+    for (int e = 1; e < PP_EFFORT_MAX; e++) {
+        if (pts[e].bpp < x0) x0 = pts[e].bpp;
+        if (pts[e].bpp > x1) x1 = pts[e].bpp;
+        if (pts[e].roundtrip_mbps < y0) y0 = pts[e].roundtrip_mbps;
+        if (pts[e].roundtrip_mbps > y1) y1 = pts[e].roundtrip_mbps;
+    }
+    if (y0 <= 0) return;
+    double dx = x1 > x0 ? x1 - x0 : 1, dy = y1 > y0 ? log(y1 / y0) : 1;
+    char grid[ROWS][COLS + 1];
+    memset(grid, ' ', sizeof(grid));
+    for (int r = 0; r < ROWS; r++) grid[r][COLS] = 0;
+    for (int e = PP_EFFORT_MAX - 1; e >= 0; e--) {
+        int c = (int)((pts[e].bpp - x0) / dx * (COLS - 1) + 0.5);
+        int r = ROWS - 1 - (int)(log(pts[e].roundtrip_mbps / y0) / dy * (ROWS - 1) + 0.5);
+        grid[r][c] = (char)('1' + e);
+    }
+    printf("\n  roundtrip MB/s\n");
+    for (int r = 0; r < ROWS; r++) {
+        printf("  %8.1f |%s\n", y0 * exp(dy * (ROWS - 1 - r) / (ROWS - 1)), grid[r]);
+    }
+    printf("  %8s +", "");
+    for (int c = 0; c < COLS; c++) putchar('-');
+    printf("\n  %8s  %-10.3f%*s%10.3f  bits/pixel\n", "", x0, COLS - 20, "", x1);
+}
+
+// Codes every input at each effort preset and reports size against speed,
+// marking the presets no other preset beats on both bits per pixel and
+// roundtrip MB/s
+int run_pareto(char** paths, int n, const char* csv_output, const bench_options* opt) {
+    scaling_input* inputs = calloc(n, sizeof(scaling_input));
+    pp_context* ctx = pp_context_create(0);
+    if (!inputs || !ctx) return 1;
+    if (opt->pin_cpu >= 0) pin_to_cpu(opt->pin_cpu);
+
+    int ret = 0;
+    double raw = 0;
+    for (int i = 0; i < n && ret == 0; i++) {
+        if (image_open(paths[i], &inputs[i].img) != 0) {
+            fprintf(stderr, "Error: Cannot load image %s: %s\n", paths[i], image_failure_reason());
+            ret = 1;
+            break;
+        }
+        raw += (double)inputs[i].img.width * inputs[i].img.height * 3;
+    }
+
+    preset_point pts[PP_EFFORT_MAX];
+    memset(pts, 0, sizeof(pts));
+    if (ret == 0) {
+        printf("Presets over %d images (%.1f MB raw), %d warmup, %d timed\n", n, raw / 1e6, opt->warmup, opt->reps);
+    }
+    for (int e = 0; e < PP_EFFORT_MAX && ret == 0; e++) {
+        if (time_preset(inputs, paths, n, raw, e + 1, ctx, opt, &pts[e]) != 0) {
+            fprintf(stderr, "Error: Coding failed at effort %d\n", e + 1);
+            ret = 1;
+        }
+    }
+
+    FILE* csv = NULL;
+    if (ret == 0) {
+        csv = fopen(csv_output, "w");
+        if (!csv) {
+            fprintf(stderr, "Error: Cannot open output CSV file\n");
+            ret = 1;
+        }
+    }
+    if (ret == 0) {
+        for (int e = 0; e < PP_EFFORT_MAX; e++) {
+            pts[e].pareto = 1;
+            for (int o = 0; o < PP_EFFORT_MAX; o++) {
+                if (pts[o].bpp <= pts[e].bpp && pts[o].roundtrip_mbps >= pts[e].roundtrip_mbps &&
+                    (pts[o].bpp < pts[e].bpp || pts[o].roundtrip_mbps > pts[e].roundtrip_mbps)) {
+                    pts[e].pareto = 0;
+                }
+            }
+        }
+
+        printf("\n%6s %-24s %12s %8s %10s %10s %10s %s\n", "effort", "pipeline", "bytes", "bpp",
+               "enc MB/s", "dec MB/s", "rt MB/s", "pareto");
+        fprintf(csv, "effort,predictor,rle,entropy,skip_blocks,bytes,bpp,encode_mbps,decode_mbps,roundtrip_mbps,"
+                     "pareto\n");
+        for (int e = 0; e < PP_EFFORT_MAX; e++) {
+            pp_options o = pp_preset(e + 1);
+            const char* pred = pp_predictor_names[o.predictor];
+            const char* rle = pp_rle_names[o.rle];
+            const char* entropy = pp_entropy_names[o.entropy];
+            int skip = (o.flags & PP_FLAG_SKIP_BLOCKS) != 0;
+            char pipeline[64];
+            snprintf(pipeline, sizeof(pipeline), "%s/%s/%s%s", pred, rle, entropy, skip ? "+skip" : "");
+            const preset_point* pt = &pts[e];
+            printf("%6d %-24s %12llu %8.3f %10.1f %10.1f %10.1f %s\n", e + 1, pipeline,
+                   (unsigned long long)pt->bytes, pt->bpp, pt->encode_mbps, pt->decode_mbps,
+                   pt->roundtrip_mbps, pt->pareto ? "*" : "");
+            fprintf(csv, "%d,%s,%s,%s,%d,%llu,%.4f,%.3f,%.3f,%.3f,%s\n", e + 1, pred, rle, entropy, skip,
+                    (unsigned long long)pt->bytes, pt->bpp, pt->encode_mbps, pt->decode_mbps,
+                    pt->roundtrip_mbps, pt->pareto ? "yes" : "no");
+        }
+        plot_presets(pts);
+        printf("\nResults written to: %s\n", csv_output);
+    }
+
+    if (csv) fclose(csv);
+    for (int i = 0; i < n; i++) {
+        image_close(&inputs[i].img);
+        free(inputs[i].compressed);
+    }
+    pp_context_free(ctx);
+    free(inputs);
+    return ret;
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [options] <input_image> <output_csv>\n", prog);
+    fprintf(stderr, "       %s [options] --corpus <manifest> <output_csv>\n", prog);
+    fprintf(stderr, "       %s [options] --compare <baseline_csv> <output_csv>\n", prog);
+    fprintf(stderr, "       %s [options] --synthetic <dir|-> <output_csv>\n", prog);
+    fprintf(stderr, "       %s [options] --scaling <manifest> <output_csv>\n", prog);
+    fprintf(stderr, "       %s [options] --pareto <manifest> <output_csv>\n", prog);
+    fprintf(stderr, "Example: %s static/image.bmp results.csv\n", prog);
+    fprintf(stderr, "\nThis will:\n");
+    fprintf(stderr, "  1. Compress and decompress the image in-process, timing each stage,\n");
+    fprintf(stderr, "     after N warmup runs (default %d) over N repetitions (default %d)\n", DEFAULT_WARMUP, DEFAULT_REPS);
+    fprintf(stderr, "  2. Convert the original to PNG\n");
+    fprintf(stderr, "  3. Compare compression ratios\n");
+    fprintf(stderr, "  4. Append results (medians) to output CSV\n");
+    fprintf(stderr, "\nOptions:\n");
+    fprintf(stderr, "  --warmup N   untimed runs before measuring\n");
+    fprintf(stderr, "  --reps N     timed runs\n");
+    fprintf(stderr, "  --pin CPU    run on CPU (corpus workers on CPU, CPU+1, ...)\n");
+    fprintf(stderr, "  --no-perf    skip hardware counters (cycles, instructions, branch, L1d\n");
+    fprintf(stderr, "               and LLC misses per stage; used whenever perf allows)\n");
+    fprintf(stderr, "  -j N         corpus worker threads (default one per CPU; use 1 for\n");
+    fprintf(stderr, "               timings free of cross-image interference)\n");
+    fprintf(stderr, "  --corpus     benchmark every image listed in <manifest> concurrently and\n");
+    fprintf(stderr, "               rewrite <output_csv> with per-image rows and an aggregate row\n");
+    fprintf(stderr, "  --compare    rerun every image in <baseline_csv> as a corpus on one thread,\n");
+    fprintf(stderr, "               print a per-image delta table and exit 2 on any regression\n");
+    fprintf(stderr, "  --synthetic  generate a seeded corpus (flat, gradient, noise, grain, checker\n");
+    fprintf(stderr, "               and split patterns at doubling sizes, plus 1-pixel strips)\n");
+    fprintf(stderr, "               into <dir> (\"-\" = new temp dir) and benchmark it as a\n");
+    fprintf(stderr, "               corpus, or with --scaling or --pareto in that mode; with\n");
+    fprintf(stderr, "               --pareto every image must round-trip at every effort\n");
+    fprintf(stderr, "  --scaling    encode and decode every image in <manifest> at 1, 2, 4 ... -j N\n");
+    fprintf(stderr, "               threads (default one per CPU) and write speedup and\n");
+    fprintf(stderr, "               efficiency per thread count to <output_csv>\n");
+    fprintf(stderr, "  --pareto     code every image in <manifest> at each effort 1-9 and write\n");
+    fprintf(stderr, "               bits/pixel and MB/s per preset, marking Pareto-optimal ones\n");
+    fprintf(stderr, "  --effort N   preset used by every other mode (default %d)\n", PP_EFFORT_DEFAULT);
+    fprintf(stderr, "  --seed N     synthetic corpus seed (default 1)\n");
+    fprintf(stderr, "  --max-mp N   largest synthetic image in megapixels (default %d)\n", DEFAULT_SYNTH_MEGAPIXELS);
+    fprintf(stderr, "  --size-tolerance PCT   allowed compressed size growth (default %.1f)\n", DEFAULT_SIZE_TOLERANCE);
+    fprintf(stderr, "  --speed-tolerance PCT  allowed drop in any stage's MB/s (default %.1f)\n", DEFAULT_SPEED_TOLERANCE);
+}
+
+int main(int argc, char* argv[]) {
+    bench_options opt = { DEFAULT_WARMUP, DEFAULT_REPS, -1, 0, 1, 1, PP_EFFORT_DEFAULT };
+    int corpus = 0, compare = 0, synthetic = 0, scaling = 0, pareto = 0;
+    uint64_t seed = 1;
+    double max_mp = DEFAULT_SYNTH_MEGAPIXELS;
+    double size_tol = DEFAULT_SIZE_TOLERANCE, speed_tol = DEFAULT_SPEED_TOLERANCE;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        const char* arg = argv[argi];
+        if (strcmp(arg, "--corpus") == 0) corpus = 1;
+        else if (strcmp(arg, "--compare") == 0) compare = 1;
+        else if (strcmp(arg, "--synthetic") == 0) synthetic = 1;
+        else if (strcmp(arg, "--scaling") == 0) scaling = 1;
+        else if (strcmp(arg, "--pareto") == 0) pareto = 1;
+        else if (strcmp(arg, "--no-perf") == 0) opt.perf = 0;
+        else if (argi + 1 >= argc) break;
+        else if (strcmp(arg, "--warmup") == 0) opt.warmup = atoi(argv[++argi]);
+        else if (strcmp(arg, "--reps") == 0) opt.reps = atoi(argv[++argi]);
+        else if (strcmp(arg, "--pin") == 0) opt.pin_cpu = atoi(argv[++argi]);
+        else if (strcmp(arg, "-j") == 0) opt.threads = atoi(argv[++argi]);
+        else if (strcmp(arg, "--effort") == 0) opt.effort = atoi(argv[++argi]);
+        else if (strcmp(arg, "--seed") == 0) seed = strtoull(argv[++argi], NULL, 10);
+        else if (strcmp(arg, "--max-mp") == 0) max_mp = atof(argv[++argi]);
+        else if (strcmp(arg, "--size-tolerance") == 0) size_tol = atof(argv[++argi]);
+        else if (strcmp(arg, "--speed-tolerance") == 0) speed_tol = atof(argv[++argi]);
+        else break;
+    }
+    if (argc - argi != 2 || opt.warmup < 0 || opt.reps < 1 || corpus + compare + scaling + pareto > 1 ||
+        (synthetic && corpus + compare) ||
+        opt.effort < PP_EFFORT_MIN || opt.effort > PP_EFFORT_MAX || max_mp <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* input = argv[argi];
+    const char* csv_output = argv[argi + 1];
+
+    if (compare) return run_compare(input, csv_output, &opt, size_tol, speed_tol);
+    char manifest[4096];
+    if (synthetic) {
+        char dir[4096];
+        if (strcmp(input, "-") == 0) {
+            const char* tmp = getenv("TMPDIR");
+            snprintf(dir, sizeof(dir), "%s/pp_synth_XXXXXX", tmp ? tmp : "/tmp");
+            if (!mkdtemp(dir)) {
+                fprintf(stderr, "Error: Cannot create temp dir\n");
+                return 1;
+            }
+        } else {
+            snprintf(dir, sizeof(dir), "%s", input);
+            mkdir(dir, 0755);
+        }
+        printf("Generating synthetic corpus in %s (seed %llu, up to %.1f MP)...\n",
+               dir, (unsigned long long)seed, max_mp);
+        if (synth_corpus(dir, seed, (uint64_t)(max_mp * 1e6), manifest, sizeof(manifest)) < 0) return 1;
+        printf("Manifest: %s\n", manifest);
+        input = manifest;
+        corpus = !scaling && !pareto;
+    }
+    if (corpus || scaling || pareto) {
+        int n = 0;
+        char** inputs = read_manifest(input, &n);
+        if (!inputs || n == 0) {
+            fprintf(stderr, "Error: Cannot read manifest: %s\n", input);
+            return 1;
+        }
+        int failed = scaling  ? run_scaling(inputs, n, csv_output, &opt)
+                   : pareto ? run_pareto(inputs, n, csv_output, &opt)
+                   : run_corpus(inputs, n, csv_output, &opt);
+        free_list(inputs, n);
+        return failed ? 1 : 0;
+    }
+
+    if (opt.pin_cpu >= 0 && pin_to_cpu(opt.pin_cpu) != 0) {
+        fprintf(stderr, "Warning: cannot pin to CPU %d, running unpinned\n", opt.pin_cpu);
+        opt.pin_cpu = -1;
+    }
+
+    if (!csv_header_matches(csv_output)) {
+        fprintf(stderr, "Error: %s has a different column layout; write to a new file\n", csv_output);
+        return 1;
+    }
+
+    printf("Benchmarking: %s\n", input);
+    printf("Running custom compression algorithm (%d warmup, %d timed%s)...\n",
+           opt.warmup, opt.reps, opt.pin_cpu >= 0 ? ", pinned" : "");
+
+    // One warm context for every run
+    pp_context* ctx = pp_context_create(0);
+    image_result res;
+    int ret = ctx ? benchmark_image(ctx, input, &opt, &res) : -1;
+    pp_context_free(ctx);
+    if (ret != 0) return 1;
+
+    printf("Image dimensions: %dx%d, channels: %d\n", res.width, res.height, res.channels);
+    printf("Original file size: %ld bytes\n", res.original_size);
+    if (!res.custom.verified) {
+        fprintf(stderr, "Warning: Decoded image does not match original!\n");
+    }
+    print_image_report(&res, opt.reps);
+
     // Write to CSV
     FILE* csv = fopen(csv_output, "a");
     if (!csv) {
         fprintf(stderr, "Error: Cannot open output CSV file\n");
         return 1;
     }
-    
+
     // Check if file is empty (write header)
     fseek(csv, 0, SEEK_END);
     if (ftell(csv) == 0) {
-        fprintf(csv, "filename,width,height,channels,original_bytes,custom_bytes,custom_ratio,custom_time,png_bytes,png_ratio,png_time,relative_performance,verified\n");
-    }
-    
-    // Write data
-    fprintf(csv, "%s,%d,%d,%d,%ld,%ld,%.6f,%.6f,%ld,%.6f,%.6f,%.6f,%s\n",
-            input, width, height, channels, original_size,
-            custom_size, custom_ratio, custom_time,
-            png_size, png_ratio, png_time,
-            relative_performance, verification ? "yes" : "no");
-    
+        write_csv_header(csv);
+    }
+    write_csv_row(csv, &res, opt.reps);
+
     fclose(csv);
     printf("\nResults appended to: %s\n", csv_output);
-    
-    // Cleanup temporary files
-    remove(compressed_file);
-    remove(decoded_file);
-    remove(png_file);
-    
     return 0;
 }
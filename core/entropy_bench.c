@@ -0,0 +1,270 @@
+// entropy_bench.c -- entropy coder microbenchmark on synthetic symbol streams
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "libs/arith.h"
+#include "libs/bittree.h"
+
+#define DEFAULT_LENGTH (1 << 20)
+#define DEFAULT_REPS 5
+
+// One entropy coder backend. Every backend codes a byte stream into a
+// caller-sized buffer and reports its own model/interval events.
+typedef struct {
+    const char* name;
+    size_t (*encode)(void* state, const unsigned char* in, size_t len, unsigned char* out, size_t cap);
+    size_t (*decode)(void* state, const unsigned char* in, size_t len, unsigned char* out, size_t cap);
+    unsigned long (*rescales)(const void* state);
+    size_t state_size;
+} backend;
+
+static size_t arith_backend_encode(void* state, const unsigned char* in, size_t len, unsigned char* out, size_t cap) {
+    return arith_encode(state, in, len, out, cap);
+}
+
+static size_t arith_backend_decode(void* state, const unsigned char* in, size_t len, unsigned char* out, size_t cap) {
+    return arith_decode(state, in, len, out, cap);
+}
+
+static unsigned long arith_backend_rescales(const void* state) {
+    return ((const arith_coder*)state)->rescales;
+}
+
+static size_t classes_backend_encode(void* state, const unsigned char* in, size_t len, unsigned char* out, size_t cap) {
+    return arith_encode_classes(state, in, len, out, cap, NULL);
+}
+
+static size_t classes_backend_decode(void* state, const unsigned char* in, size_t len, unsigned char* out, size_t cap) {
+    return arith_decode_classes(state, in, len, out, cap);
+}
+
+static size_t bittree_backend_encode(void* state, const unsigned char* in, size_t len, unsigned char* out, size_t cap) {
+    return bittree_encode(state, in, len, out, cap, NULL);
+}
+
+static size_t bittree_backend_decode(void* state, const unsigned char* in, size_t len, unsigned char* out, size_t cap) {
+    return bittree_decode(state, in, len, out, cap);
+}
+
+// Probabilities adapt continuously; nothing is ever rescaled
+static unsigned long bittree_backend_rescales(const void* state) {
+    (void)state;
+    return 0;
+}
+
+static const backend backends[] = {
+    { "arith", arith_backend_encode, arith_backend_decode, arith_backend_rescales, sizeof(arith_coder) },
+    { "classes", classes_backend_encode, classes_backend_decode, arith_backend_rescales, sizeof(arith_coder) },
+    { "bittree", bittree_backend_encode, bittree_backend_decode, bittree_backend_rescales, sizeof(bittree_coder) },
+};
+#define N_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+typedef enum { DIST_UNIFORM, DIST_GEOMETRIC, DIST_LAPLACIAN, DIST_CONSTANT, DIST_ALTERNATING } dist_kind;
+
+typedef struct {
+    const char* name;
+    dist_kind kind;
+    double param;       // geometric: P(0); laplacian: scale
+} distribution;
+
+static const distribution distributions[] = {
+    { "uniform", DIST_UNIFORM, 0 },
+    { "geometric-0.5", DIST_GEOMETRIC, 0.5 },
+    { "geometric-0.8", DIST_GEOMETRIC, 0.8 },
+    { "geometric-0.95", DIST_GEOMETRIC, 0.95 },
+    { "geometric-0.99", DIST_GEOMETRIC, 0.99 },
+    { "laplacian-1", DIST_LAPLACIAN, 1 },
+    { "laplacian-4", DIST_LAPLACIAN, 4 },
+    { "laplacian-16", DIST_LAPLACIAN, 16 },
+    { "constant", DIST_CONSTANT, 0 },
+    { "alternating", DIST_ALTERNATING, 0 },
+};
+#define N_DISTRIBUTIONS (sizeof(distributions) / sizeof(distributions[0]))
+
+static uint64_t next_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in (0, 1)
+static double next_unit(uint64_t* state) {
+    return ((next_random(state) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+// Fills buf with len symbols. Laplacian values are wrapped to bytes the
+// way compute_residuals() stores prediction errors.
+void generate(const distribution* d, uint64_t seed, unsigned char* buf, size_t len) {
+    uint64_t state = seed;
+    for (size_t i = 0; i < len; i++) {
+        switch (d->kind) {
+        case DIST_UNIFORM:
+            buf[i] = (unsigned char)next_random(&state);
+            break;
+        case DIST_GEOMETRIC: {
+            double k = floor(log(next_unit(&state)) / log(1.0 - d->param));
+            buf[i] = (unsigned char)(k > 255 ? 255 : k);
+            break;
+        }
+        case DIST_LAPLACIAN: {
+            double u = next_unit(&state) - 0.5;
+            double v = -d->param * (u < 0 ? -1 : 1) * log(1 - 2 * fabs(u));
+            buf[i] = (unsigned char)(int)lround(v);
+            break;
+        }
+        case DIST_CONSTANT:
+            buf[i] = 0;
+            break;
+        case DIST_ALTERNATING:
+            buf[i] = (i & 1) ? 0xFF : 0x00;
+            break;
+        }
+    }
+}
+
+// Order-0 Shannon entropy of the stream in bits per symbol
+double shannon_entropy(const unsigned char* buf, size_t len) {
+    size_t hist[256] = {0};
+    for (size_t i = 0; i < len; i++) hist[buf[i]]++;
+    double h = 0;
+    for (int s = 0; s < 256; s++) {
+        if (!hist[s]) continue;
+        double p = (double)hist[s] / len;
+        h -= p * log2(p);
+    }
+    return h;
+}
+
+double get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+double median(double* v, int n) {
+    qsort(v, n, sizeof(double), compare_doubles);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-n symbols] [--reps N] [--seed N] [--backend NAME] [--csv out.csv]\n", prog);
+    fprintf(stderr, "\nCodes synthetic symbol streams (uniform, geometric, Laplacian residual-like,\n");
+    fprintf(stderr, "constant, alternating) with each entropy backend and reports ns/symbol,\n");
+    fprintf(stderr, "bits/symbol against the order-0 Shannon entropy, and model rescales.\n");
+    fprintf(stderr, "Defaults: %d symbols, %d timed runs (medians).\n", DEFAULT_LENGTH, DEFAULT_REPS);
+}
+
+int main(int argc, char* argv[]) {
+    size_t len = DEFAULT_LENGTH;
+    int reps = DEFAULT_REPS;
+    uint64_t seed = 1;
+    const char* only = NULL;
+    const char* csv_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-n") == 0) len = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--reps") == 0) reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--backend") == 0) only = argv[++i];
+        else if (strcmp(argv[i], "--csv") == 0) csv_path = argv[++i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (len == 0 || reps < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Room for a little expansion on incompressible input
+    size_t cap = len + len / 8 + 4096;
+    unsigned char* input = malloc(len);
+    unsigned char* coded = malloc(cap);
+    unsigned char* decoded = malloc(len);
+    double* enc_times = malloc(reps * sizeof(double));
+    double* dec_times = malloc(reps * sizeof(double));
+    if (!input || !coded || !decoded || !enc_times || !dec_times) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    FILE* csv = NULL;
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) {
+            fprintf(stderr, "Error: Cannot open %s\n", csv_path);
+            return 1;
+        }
+        fprintf(csv, "backend,distribution,symbols,entropy_bits,coded_bits,overhead_pct,encode_ns,decode_ns,rescales,verified\n");
+    }
+
+    printf("%zu symbols, %d runs, seed %llu\n\n", len, reps, (unsigned long long)seed);
+    printf("%-8s %-16s %9s %9s %9s %10s %10s %9s %s\n", "backend", "distribution", "entropy", "bits/sym",
+           "overhead", "enc ns/sym", "dec ns/sym", "rescales", "verified");
+
+    int failed = 0;
+    for (size_t b = 0; b < N_BACKENDS; b++) {
+        const backend* be = &backends[b];
+        if (only && strcmp(only, be->name) != 0) continue;
+        void* state = malloc(be->state_size);
+
+        for (size_t d = 0; d < N_DISTRIBUTIONS; d++) {
+            generate(&distributions[d], seed, input, len);
+            double entropy = shannon_entropy(input, len);
+
+            // One untimed run warms caches and the branch predictor
+            size_t coded_len = 0;
+            int verified = 1;
+            for (int r = -1; r < reps; r++) {
+                double start = get_time();
+                coded_len = be->encode(state, input, len, coded, cap);
+                double mid = get_time();
+                size_t out_len = be->decode(state, coded, coded_len < cap ? coded_len : cap, decoded, len);
+                double end = get_time();
+                verified &= coded_len <= cap && out_len == len && memcmp(input, decoded, len) == 0;
+                if (r >= 0) {
+                    enc_times[r] = mid - start;
+                    dec_times[r] = end - mid;
+                }
+            }
+            be->encode(state, input, len, coded, cap);
+            unsigned long rescales = be->rescales(state);
+
+            double bits = coded_len * 8.0 / len;
+            double overhead = entropy > 0 ? (bits / entropy - 1) * 100 : 0;
+            double enc_ns = median(enc_times, reps) * 1e9 / len;
+            double dec_ns = median(dec_times, reps) * 1e9 / len;
+            printf("%-8s %-16s %9.4f %9.4f %8.2f%% %10.2f %10.2f %9lu %s\n", be->name, distributions[d].name,
+                   entropy, bits, overhead, enc_ns, dec_ns, rescales, verified ? "PASS" : "FAIL");
+            if (csv) {
+                fprintf(csv, "%s,%s,%zu,%.6f,%.6f,%.4f,%.3f,%.3f,%lu,%s\n", be->name, distributions[d].name,
+                        len, entropy, bits, overhead, enc_ns, dec_ns, rescales, verified ? "yes" : "no");
+            }
+            failed += !verified;
+        }
+        free(state);
+    }
+
+    if (csv) fclose(csv);
+    free(input);
+    free(coded);
+    free(decoded);
+    free(enc_times);
+    free(dec_times);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+// analyze.c -- residual entropy report against actual coded size
+#include "analyze.h"
+#include "arith.h"
+#include "codec.h"
+#include "imgio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef enum { XF_RAW, XF_LEFT, XF_MED, XF_SUBGREEN, XF_COUNT } transform;
+
+static const char* const transform_names[XF_COUNT] = { "raw", "left", "med", "med_subgreen" };
+static const char* const channel_names[3] = { "r", "g", "b" };
+
+// Order-0 entropy in bits per sample of a w x h region of a plane
+static double region_entropy(const uint8_t* p, size_t stride, int w, int h) {
+    size_t hist[256] = {0};
+    for (int y = 0; y < h; y++) {
+        const uint8_t* row = p + y * stride;
+        for (int x = 0; x < w; x++) hist[row[x]]++;
+    }
+    double n = (double)w * h, bits = 0;
+    for (int s = 0; s < 256; s++) {
+        if (hist[s]) bits -= hist[s] * log2(hist[s] / n);
+    }
+    return bits / n;
+}
+
+static void left_residuals(const uint8_t* src, int width, int height, uint8_t* out) {
+    for (int y = 0; y < height; y++) {
+        const uint8_t* cur = src + (size_t)y * width;
+        uint8_t* res = out + (size_t)y * width;
+        res[0] = (uint8_t)(cur[0] - (y > 0 ? cur[-width] : 0));
+        for (int x = 1; x < width; x++) res[x] = (uint8_t)(cur[x] - cur[x - 1]);
+    }
+}
+
+// Every transform of every channel as a full-size plane:
+// planes[t][c] holds w * h samples
+typedef struct {
+    int width, height;
+    uint8_t* mem;
+    uint8_t* planes[XF_COUNT][3];
+} transforms;
+
+static int build_transforms(const image_view* img, transforms* t) {
+    int w = img->width, h = img->height;
+    size_t n = (size_t)w * h;
+    t->width = w;
+    t->height = h;
+    t->mem = malloc((XF_COUNT + 1) * 3 * n);
+    if (!t->mem) return -1;
+    for (int x = 0; x < XF_COUNT; x++) {
+        for (int c = 0; c < 3; c++) t->planes[x][c] = t->mem + (x * 3 + c) * n;
+    }
+    uint8_t* sub = t->mem + XF_COUNT * 3 * n;    // R-G, G, B-G before prediction
+
+    int ri = img->bgr ? 2 : 0, bi = img->bgr ? 0 : 2;
+    for (int y = 0; y < h; y++) {
+        const unsigned char* row = img->row0 + (ptrdiff_t)y * img->stride;
+        for (int x = 0; x < w; x++) {
+            size_t i = (size_t)y * w + x;
+            t->planes[XF_RAW][0][i] = row[3*x + ri];
+            t->planes[XF_RAW][1][i] = row[3*x + 1];
+            t->planes[XF_RAW][2][i] = row[3*x + bi];
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        const uint8_t* raw = t->planes[XF_RAW][c];
+        const uint8_t* green = t->planes[XF_RAW][1];
+        left_residuals(raw, w, h, t->planes[XF_LEFT][c]);
+        compute_residuals(raw, NULL, w, h, t->planes[XF_MED][c]);
+        uint8_t* s = sub + c * n;
+        for (size_t i = 0; i < n; i++) s[i] = c == 1 ? raw[i] : (uint8_t)(raw[i] - green[i]);
+        compute_residuals(s, NULL, w, h, t->planes[XF_SUBGREEN][c]);
+    }
+    return 0;
+}
+
+// Compressed size of img at one effort; fills map if set
+static long coded_bytes(const image_view* img, int effort, float* map) {
+    pp_context* ctx = pp_context_create(0);
+    FILE* f = fopen("/dev/null", "wb");
+    pp_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.bit_map = map;
+    pp_options opts = pp_preset(effort);
+    uint64_t bytes = 0;
+    int ret = -1;
+    if (ctx && f) {
+        pp_set_stats(ctx, &stats);
+        ret = pp_encode(ctx, img, 0, &opts, f, &bytes);
+    }
+    if (f) fclose(f);
+    pp_context_free(ctx);
+    return ret == 0 ? (long)bytes : -1;
+}
+
+// Bits the adaptive coder spends on one plane on its own
+static double arith_bits(arith_coder* ac, const uint8_t* plane, size_t n) {
+    size_t cap = n + n / 8 + 4096;
+    unsigned char* out = malloc(cap);
+    if (!out) return -1;
+    size_t len = arith_encode(ac, plane, n, out, cap);
+    free(out);
+    return len * 8.0;
+}
+
+static void write_tiles(FILE* csv, const char* path, const transforms* t, const float* map, int tile,
+                        int* best_counts, double* gaps, int* n_gaps) {
+    int w = t->width, h = t->height;
+    for (int ty = 0; ty < h; ty += tile) {
+        int th = ty + tile < h ? tile : h - ty;
+        for (int tx = 0; tx < w; tx += tile) {
+            int tw = tx + tile < w ? tile : w - tx;
+            double sum[XF_COUNT] = {0};
+            for (int c = 0; c < 3; c++) {
+                double e[XF_COUNT];
+                for (int x = 0; x < XF_COUNT; x++) {
+                    e[x] = region_entropy(t->planes[x][c] + (size_t)ty * w + tx, w, tw, th);
+                    sum[x] += e[x];
+                }
+                if (csv) {
+                    fprintf(csv, "%s,%d,%d,%d,%d,%s,%.4f,%.4f,%.4f,%.4f,\n", path, tx, ty, tw, th,
+                            channel_names[c], e[XF_RAW], e[XF_LEFT], e[XF_MED], e[XF_SUBGREEN]);
+                }
+            }
+
+            double coded = 0;
+            for (int y = ty; y < ty + th; y++) {
+                for (int x = tx; x < tx + tw; x++) coded += map[(size_t)y * w + x];
+            }
+            coded /= (double)tw * th;
+
+            int best = 0;
+            for (int x = 1; x < XF_COUNT; x++) {
+                if (sum[x] < sum[best]) best = x;
+            }
+            best_counts[best]++;
+            if (sum[best] > 0) gaps[(*n_gaps)++] = coded / sum[best] - 1;
+            if (csv) {
+                fprintf(csv, "%s,%d,%d,%d,%d,all,%.4f,%.4f,%.4f,%.4f,%.4f\n", path, tx, ty, tw, th,
+                        sum[XF_RAW], sum[XF_LEFT], sum[XF_MED], sum[XF_SUBGREEN], coded);
+            }
+        }
+    }
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int analyze_image(const char* path, int tile, FILE* csv, arith_coder* ac) {
+    image_view img;
+    if (image_open(path, &img) != 0) {
+        fprintf(stderr, "Cannot load %s: %s\n", path, image_failure_reason());
+        return -1;
+    }
+    int w = img.width, h = img.height;
+    size_t n = (size_t)w * h;
+    transforms t;
+    float* map = calloc(n, sizeof(float));
+    if (!map || build_transforms(&img, &t) != 0) {
+        fprintf(stderr, "Out of memory: %s\n", path);
+        free(map);
+        image_close(&img);
+        return -1;
+    }
+    long dflt = coded_bytes(&img, PP_EFFORT_DEFAULT, map);
+    long densest = coded_bytes(&img, PP_EFFORT_MAX, NULL);
+    image_close(&img);
+    if (dflt < 0 || densest < 0) {
+        fprintf(stderr, "Encoding failed: %s\n", path);
+        free(map);
+        free(t.mem);
+        return -1;
+    }
+
+    printf("%s: %dx%d\n", path, w, h);
+    printf("  %-14s %8s %8s %8s %12s\n", "bits/sample", "R", "G", "B", "bits/pixel");
+    double med_total = 0;
+    for (int x = 0; x < XF_COUNT; x++) {
+        double e[3];
+        for (int c = 0; c < 3; c++) e[c] = region_entropy(t.planes[x][c], w, w, h);
+        printf("  %-14s %8.4f %8.4f %8.4f %12.4f\n", transform_names[x], e[0], e[1], e[2], e[0] + e[1] + e[2]);
+        if (x == XF_MED) med_total = e[0] + e[1] + e[2];
+    }
+    double arith[3];
+    for (int c = 0; c < 3; c++) arith[c] = arith_bits(ac, t.planes[XF_MED][c], n) / n;
+    double arith_total = arith[0] + arith[1] + arith[2];
+    printf("  %-14s %8.4f %8.4f %8.4f %12.4f  coder on each med plane alone\n", "arith(med)",
+           arith[0], arith[1], arith[2], arith_total);
+    printf("  codec -%-7d %8s %8s %8s %12.4f  %ld bytes, whole file\n", PP_EFFORT_DEFAULT, "", "", "",
+           dflt * 8.0 / n, dflt);
+    printf("  codec -%-7d %8s %8s %8s %12.4f  %ld bytes, whole file\n", PP_EFFORT_MAX, "", "", "",
+           densest * 8.0 / n, densest);
+    if (med_total > 0) printf("  adaptive model vs med entropy: %+.2f%%\n", (arith_total / med_total - 1) * 100);
+
+    int best_counts[XF_COUNT] = {0};
+    size_t max_tiles = (size_t)((w + tile - 1) / tile) * ((h + tile - 1) / tile);
+    double* gaps = malloc(max_tiles * sizeof(double));
+    int n_gaps = 0;
+    if (gaps) {
+        write_tiles(csv, path, &t, map, tile, best_counts, gaps, &n_gaps);
+        printf("  %dx%d tiles, lowest entropy:", tile, tile);
+        for (int x = 0; x < XF_COUNT; x++) printf(" %s %d", transform_names[x], best_counts[x]);
+        printf("\n");
+        if (n_gaps > 0) {
+            qsort(gaps, n_gaps, sizeof(double), compare_doubles);
+            printf("  codec -%d over each tile's best entropy: median %+.1f%%, worst %+.1f%%\n", PP_EFFORT_DEFAULT,
+                   gaps[n_gaps / 2] * 100, gaps[n_gaps - 1] * 100);
+        }
+    }
+    printf("\n");
+
+    free(gaps);
+    free(map);
+    free(t.mem);
+    return gaps ? 0 : -1;
+}
+
+int analyze_run(const batch_list* list, int tile, const char* csv_path) {
+    FILE* csv = NULL;
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) {
+            fprintf(stderr, "Cannot write %s\n", csv_path);
+            return (int)list->count;
+        }
+        fprintf(csv, "image,tile_x,tile_y,tile_w,tile_h,channel");
+        for (int x = 0; x < XF_COUNT; x++) fprintf(csv, ",%s", transform_names[x]);
+        fprintf(csv, ",coded\n");
+    }
+
+    arith_coder* ac = malloc(sizeof(arith_coder));
+    int failed = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (!ac || analyze_image(list->jobs[i].input, tile, csv, ac) != 0) failed++;
+    }
+    free(ac);
+    if (csv) fclose(csv);
+    return failed;
+}
@@ -0,0 +1,18 @@
+// analyze.h -- residual entropy report against actual coded size
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include "batch.h"
+
+#define ANALYZE_DEFAULT_TILE 64
+
+// For every input in list, prints the order-0 entropy of each channel
+// under every transform (raw pixels, left and MED residuals, MED after
+// subtracting green), the bits the adaptive arithmetic coder spends on the
+// MED residuals of each channel, and the codec's actual output at default
+// and densest effort. Per tile x tile block the same entropies and the
+// coded bits (from pp_stats.bit_map) go to csv_path if set. Returns the
+// number of inputs that could not be analysed.
+int analyze_run(const batch_list* list, int tile, const char* csv_path);
+
+#endif // ANALYZE_H
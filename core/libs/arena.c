@@ -0,0 +1,67 @@
+// arena.c -- bump allocator over one reusable mapping
+#include "arena.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define ARENA_ALIGN 64
+#define HUGE_PAGE_SIZE (2u << 20)
+
+static size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+// Anonymous mapping aligned to HUGE_PAGE_SIZE so THP can cover all of it
+static unsigned char* map_huge(size_t size) {
+    size_t span = size + HUGE_PAGE_SIZE;
+    unsigned char* raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+
+    unsigned char* base = (unsigned char*)round_up((uintptr_t)raw, HUGE_PAGE_SIZE);
+    if (base > raw) munmap(raw, base - raw);
+    munmap(base + size, raw + span - (base + size));
+#ifdef MADV_HUGEPAGE
+    madvise(base, size, MADV_HUGEPAGE);
+#endif
+    return base;
+}
+
+int arena_reserve(arena* a, size_t bytes) {
+    a->used = 0;
+    if (a->size >= bytes) return 0;
+
+    arena_release(a);
+    size_t size;
+    unsigned char* base;
+    if (a->huge_pages) {
+        size = round_up(bytes, HUGE_PAGE_SIZE);
+        base = map_huge(size);
+    } else {
+        size = round_up(bytes, (size_t)sysconf(_SC_PAGESIZE));
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) base = NULL;
+    }
+    if (!base) return -1;
+
+    a->base = base;
+    a->size = size;
+    return 0;
+}
+
+void* arena_alloc(arena* a, size_t bytes) {
+    size_t start = round_up(a->used, ARENA_ALIGN);
+    if (start > a->size || a->size - start < bytes) return NULL;
+    a->used = start + bytes;
+    return a->base + start;
+}
+
+void arena_reset(arena* a) {
+    a->used = 0;
+}
+
+void arena_release(arena* a) {
+    if (a->base) munmap(a->base, a->size);
+    a->base = NULL;
+    a->size = 0;
+    a->used = 0;
+}
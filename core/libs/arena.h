@@ -0,0 +1,27 @@
+// arena.h -- bump allocator over one reusable mapping
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct {
+    unsigned char* base;
+    size_t size;            // bytes mapped
+    size_t used;
+    int huge_pages;         // back the mapping with transparent huge pages
+} arena;
+
+// Makes room for at least `bytes`, remapping only if the arena is too
+// small, and discards everything allocated so far. Worst-case stage bounds
+// are reserved but only touched pages become resident; they stay mapped,
+// so reusing the arena for the next image costs no page faults.
+// Returns 0 or -1.
+int arena_reserve(arena* a, size_t bytes);
+
+// 64-byte aligned; NULL if the reservation is exhausted
+void* arena_alloc(arena* a, size_t bytes);
+
+void arena_reset(arena* a);
+void arena_release(arena* a);
+
+#endif // ARENA_H
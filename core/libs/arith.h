@@ -4,6 +4,68 @@
 
 #include <stddef.h>
 
+#define N_SYMBOLS 256
+
+// All coder state lives here so independent images can be coded
+// concurrently, one context per thread.
+typedef struct {
+    unsigned int cum_freq[N_SYMBOLS + 1];
+    unsigned int freq[N_SYMBOLS];
+    int total_freq;
+    int n_symbols;                  // alphabet of the current model
+    int max_total;                  // total_freq that triggers a rescale
+
+    unsigned long low, high;
+    unsigned long underflow_bits;
+    unsigned long code_value;
+
+    // Model and interval events over the last arith_encode/arith_decode
+    unsigned long rescales;         // frequency halvings
+    unsigned long underflows;       // E3 (straddling) interval expansions
+
+    unsigned char* out_buf;
+    size_t out_pos;
+    size_t out_capacity;
+    unsigned char output_buffer;
+    int output_bits_to_go;
+
+    const unsigned char* in_buf;
+    size_t in_pos;
+    size_t in_len;
+    unsigned char input_buffer;
+    int input_bits_left;
+
+    unsigned long image_id;         // passed to the probes, set by the caller
+} arith_coder;
+
+// Returns the length of the whole coded stream, of which only the first
+// output_capacity bytes are stored: a result above output_capacity means
+// the output did not fit.
+size_t arith_encode(arith_coder* ac, const unsigned char* input, size_t input_len,
+                    unsigned char* output, size_t output_capacity);
+
+// arith_encode() that also stores each symbol's cost in bits (input_len
+// floats), measured as the narrowing of the coding interval. Diagnostic.
+size_t arith_encode_costs(arith_coder* ac, const unsigned char* input, size_t input_len,
+                          unsigned char* output, size_t output_capacity, float* bits);
+
+size_t arith_decode(arith_coder* ac, const unsigned char* input, size_t input_len,
+                    unsigned char* output, size_t output_capacity);
+
+// Magnitude-class binarisation. Each byte, read as a signed residual v,
+// is coded as its class (0 for v = 0, else k with 2^(k-1) <= |v| < 2^k)
+// from a 9-symbol adaptive model, then k equiprobable bypass bits: the
+// sign and the bits of |v| below its leading one. Model updates and the
+// decoder's symbol search cost a fraction of the 256-symbol coder's.
+// bits, if not NULL, receives each byte's cost as in arith_encode_costs().
+size_t arith_encode_classes(arith_coder* ac, const unsigned char* input, size_t input_len,
+                            unsigned char* output, size_t output_capacity, float* bits);
+
+// Decodes exactly output_capacity bytes and returns that count
+size_t arith_decode_classes(arith_coder* ac, const unsigned char* input, size_t input_len,
+                            unsigned char* output, size_t output_capacity);
+
+// Same as above with a temporary context
 size_t arithmetic_encode(const unsigned char* input, size_t input_len,
                          unsigned char* output, size_t output_capacity);
 
@@ -0,0 +1,238 @@
+// batch.c -- encode or decode many images in one process
+#include "batch.h"
+#include "codec.h"
+#include "imgio.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+typedef struct {
+    batch_job* job;
+    pp_context** contexts;     // one per worker
+    int decode;
+    int strip_rows;
+    pp_options opts;
+    int verbose;
+} batch_task;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int add_job(batch_list* list, const char* input, const char* outdir, const char* ext) {
+    if (list->count == list->capacity) {
+        size_t cap = list->capacity ? list->capacity * 2 : 64;
+        batch_job* jobs = realloc(list->jobs, cap * sizeof(batch_job));
+        if (!jobs) return -1;
+        list->jobs = jobs;
+        list->capacity = cap;
+    }
+
+    // outdir/<stem><ext>
+    const char* base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    const char* dot = strrchr(base, '.');
+    size_t stem = dot && dot != base ? (size_t)(dot - base) : strlen(base);
+    size_t len = strlen(outdir) + 1 + stem + strlen(ext) + 1;
+
+    batch_job* job = &list->jobs[list->count];
+    memset(job, 0, sizeof(*job));
+    job->input = strdup(input);
+    job->output = malloc(len);
+    if (!job->input || !job->output) {
+        free(job->input);
+        free(job->output);
+        return -1;
+    }
+    snprintf(job->output, len, "%s/%.*s%s", outdir, (int)stem, base, ext);
+    list->count++;
+    return 0;
+}
+
+int batch_add(batch_list* list, const char* path, const char* outdir, const char* ext) {
+    if (path[0] == '@') {
+        FILE* f = fopen(path + 1, "r");
+        if (!f) return -1;
+        char line[4096];
+        int ret = 0;
+        while (ret == 0 && fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (line[0]) ret = batch_add(list, line, outdir, ext);
+        }
+        fclose(f);
+        return ret;
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    if (!S_ISDIR(st.st_mode)) return add_job(list, path, outdir, ext);
+
+    DIR* dir = opendir(path);
+    if (!dir) return -1;
+    struct dirent* ent;
+    int ret = 0;
+    while (ret == 0 && (ent = readdir(dir))) {
+        if (ent->d_name[0] == '.') continue;
+        size_t len = strlen(path) + strlen(ent->d_name) + 2;
+        char* child = malloc(len);
+        if (!child) {
+            ret = -1;
+            break;
+        }
+        snprintf(child, len, "%s/%s", path, ent->d_name);
+        if (stat(child, &st) == 0 && S_ISREG(st.st_mode)) ret = add_job(list, child, outdir, ext);
+        free(child);
+    }
+    closedir(dir);
+    return ret;
+}
+
+void batch_free(batch_list* list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->jobs[i].input);
+        free(list->jobs[i].output);
+    }
+    free(list->jobs);
+    memset(list, 0, sizeof(*list));
+}
+
+static int encode_job(batch_job* job, pp_context* ctx, int strip_rows, const pp_options* opts) {
+    image_view img;
+    if (image_open(job->input, &img) != 0) return -1;
+    job->width = img.width;
+    job->height = img.height;
+
+    FILE* f = fopen(job->output, "wb");
+    if (!f) {
+        image_close(&img);
+        return -1;
+    }
+    int ret = pp_encode(ctx, &img, strip_rows, opts, f, &job->out_bytes);
+    image_close(&img);
+    if (fclose(f) != 0) ret = -1;
+    if (ret != 0) remove(job->output);     // a partial file would pass for a result
+    return ret;
+}
+
+static int decode_job(batch_job* job, pp_context* ctx) {
+    FILE* f = fopen(job->input, "rb");
+    if (!f) return -1;
+
+    pp_header hdr;
+    image_view out;
+    if (pp_read_header(f, &hdr) != 0 || image_create(job->output, hdr.width, hdr.height, &out) != 0) {
+        fclose(f);
+        return -1;
+    }
+    job->width = hdr.width;
+    job->height = hdr.height;
+    int ret = pp_decode(ctx, f, &hdr, &out);
+    image_close(&out);
+    fclose(f);
+    if (ret != 0) remove(job->output);
+
+    struct stat st;
+    if (ret == 0 && stat(job->output, &st) == 0) job->out_bytes = (uint64_t)st.st_size;
+    return ret;
+}
+
+static void run_task(void* arg, int worker) {
+    batch_task* t = arg;
+    batch_job* job = t->job;
+    pp_context* ctx = t->contexts[worker];
+
+    double start = now_seconds();
+    int ret = ctx ? (t->decode ? decode_job(job, ctx) : encode_job(job, ctx, t->strip_rows, &t->opts)) : -1;
+    job->seconds = now_seconds() - start;
+    job->ok = ret == 0;
+
+    if (!job->ok) {
+        fprintf(stderr, "%s: failed\n", job->input);
+    } else if (t->verbose) {
+        printf("%s -> %s: %llu -> %llu bytes in %.3f s\n", job->input, job->output,
+               (unsigned long long)job->in_bytes, (unsigned long long)job->out_bytes, job->seconds);
+    }
+}
+
+static int by_output(const void* a, const void* b) {
+    return strcmp((*(batch_job* const*)a)->output, (*(batch_job* const*)b)->output);
+}
+
+static int by_size(const void* a, const void* b) {
+    const batch_job* x = *(batch_job* const*)a;
+    const batch_job* y = *(batch_job* const*)b;
+    return (x->in_bytes > y->in_bytes) - (x->in_bytes < y->in_bytes);
+}
+
+int batch_run(batch_list* list, int threads, int decode, int strip_rows, int effort, int huge_pages,
+              int verbose) {
+    size_t n = list->count;
+    pool* p = pool_create(threads);
+    batch_task* tasks = calloc(n ? n : 1, sizeof(batch_task));
+    batch_job** order = calloc(n ? n : 1, sizeof(batch_job*));
+    pp_context** contexts = p ? calloc(pool_threads(p), sizeof(pp_context*)) : NULL;
+    if (!p || !tasks || !order || !contexts) {
+        pool_destroy(p);
+        free(tasks);
+        free(order);
+        free(contexts);
+        return (int)n;
+    }
+    for (int i = 0; i < pool_threads(p); i++) {
+        contexts[i] = pp_context_create(huge_pages);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        struct stat st;
+        list->jobs[i].in_bytes = stat(list->jobs[i].input, &st) == 0 ? (uint64_t)st.st_size : 0;
+        order[i] = &list->jobs[i];
+    }
+
+    // Inputs with the same stem (a/x.bmp and b/x.bmp, or y.bmp and y.ppm)
+    // would write one output concurrently; none of them is run.
+    qsort(order, n, sizeof(batch_job*), by_output);
+    for (size_t i = 0; i + 1 < n; i++) {
+        if (strcmp(order[i]->output, order[i + 1]->output) == 0) order[i]->clash = order[i + 1]->clash = 1;
+    }
+
+    // Submitted smallest first: owners pop their newest (largest) task,
+    // thieves take the oldest (smallest), so big images start early and
+    // small ones fill the gaps around them.
+    qsort(order, n, sizeof(batch_job*), by_size);
+    for (size_t i = 0; i < n; i++) {
+        if (order[i]->clash) {
+            fprintf(stderr, "%s: skipped, another input also writes %s\n", order[i]->input, order[i]->output);
+            continue;
+        }
+        tasks[i].job = order[i];
+        tasks[i].contexts = contexts;
+        tasks[i].decode = decode;
+        tasks[i].strip_rows = strip_rows;
+        tasks[i].opts = pp_preset(effort);
+        tasks[i].verbose = verbose;
+        if (pool_submit(p, run_task, &tasks[i]) != 0) {
+            fprintf(stderr, "%s: failed to queue\n", order[i]->input);
+        }
+    }
+    pool_wait(p);
+
+    for (int i = 0; i < pool_threads(p); i++) {
+        pp_context_free(contexts[i]);
+    }
+    pool_destroy(p);
+    free(contexts);
+    free(tasks);
+    free(order);
+
+    int failed = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!list->jobs[i].ok) failed++;
+    }
+    return failed;
+}
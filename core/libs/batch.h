@@ -0,0 +1,41 @@
+// batch.h -- encode or decode many images in one process
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    char* input;
+    char* output;
+
+    // Filled in by batch_run()
+    int ok;
+    int clash;          // output path shared with another job; not run
+    int width, height;
+    uint64_t in_bytes, out_bytes;
+    double seconds;
+} batch_job;
+
+typedef struct {
+    batch_job* jobs;
+    size_t count;
+    size_t capacity;
+} batch_list;
+
+// Adds one job per input. `path` may be an image, a directory (every
+// regular, non-hidden file in it) or "@file" listing one path per line.
+// Outputs are named after the input stem with `ext` in outdir.
+int batch_add(batch_list* list, const char* path, const char* outdir, const char* ext);
+void batch_free(batch_list* list);
+
+// Runs every job on a work-stealing pool of `threads` workers (0 = one per
+// CPU), each with its own reusable codec context (see pp_context_create()
+// for huge_pages). Encodes use pp_preset(effort). Largest inputs start
+// first. Jobs whose output path another job shares are not run, and a
+// job that fails removes its partial output. Returns the number of failed
+// jobs.
+int batch_run(batch_list* list, int threads, int decode, int strip_rows, int effort, int huge_pages,
+              int verbose);
+
+#endif // BATCH_H
@@ -0,0 +1,123 @@
+// bittree.c -- binary adaptive range coder over a 255-node bit tree
+#include "bittree.h"
+#include "probes.h"
+#include <math.h>
+
+#define PROB_ONE (1u << BITTREE_PROB_BITS)
+#define TOP (1u << 24)          // renormalise once range drops below this
+
+static void model_init(bittree_coder* bc) {
+    for (int i = 0; i < 256; i++) bc->probs[i] = PROB_ONE / 2;
+}
+
+// Counted past the end too, so the caller learns the output did not fit
+static void write_byte(bittree_coder* bc, uint8_t b) {
+    if (bc->out_pos < bc->out_capacity) bc->out_buf[bc->out_pos] = b;
+    bc->out_pos++;
+}
+
+// Emits the top byte of low. A byte of 0xFF may still take a carry, so
+// runs of them wait in cache_size until the next byte settles them.
+static void shift_low(bittree_coder* bc) {
+    if ((uint32_t)bc->low < 0xFF000000u || (bc->low >> 32) != 0) {
+        uint8_t carry = (uint8_t)(bc->low >> 32);
+        uint8_t b = bc->cache;
+        do {
+            write_byte(bc, (uint8_t)(b + carry));
+            b = 0xFF;
+        } while (--bc->cache_size != 0);
+        bc->cache = (uint8_t)(bc->low >> 24);
+    }
+    bc->cache_size++;
+    bc->low = (bc->low & 0x00FFFFFFu) << 8;
+}
+
+static void encode_bit(bittree_coder* bc, uint16_t* p, int bit) {
+    uint32_t bound = (bc->range >> BITTREE_PROB_BITS) * *p;
+    if (!bit) {
+        bc->range = bound;
+        *p += (PROB_ONE - *p) >> BITTREE_ADAPT_SHIFT;
+    } else {
+        bc->low += bound;
+        bc->range -= bound;
+        *p -= *p >> BITTREE_ADAPT_SHIFT;
+    }
+    while (bc->range < TOP) {
+        bc->range <<= 8;
+        shift_low(bc);
+    }
+}
+
+size_t bittree_encode(bittree_coder* bc, const unsigned char* input, size_t input_len,
+                      unsigned char* output, size_t output_capacity, float* bits) {
+    PP_PROBE3(arith_start, bc->image_id, 0, input_len);
+    model_init(bc);
+    bc->low = 0;
+    bc->range = 0xFFFFFFFFu;
+    bc->cache = 0;
+    bc->cache_size = 1;
+    bc->out_buf = output;
+    bc->out_pos = 0;
+    bc->out_capacity = output_capacity;
+
+    for (size_t i = 0; i < input_len; i++) {
+        unsigned node = 1;
+        double p_sym = 1;
+        for (int k = 7; k >= 0; k--) {
+            int bit = input[i] >> k & 1;
+            if (bits) p_sym *= (bit ? PROB_ONE - bc->probs[node] : bc->probs[node]) / (double)PROB_ONE;
+            encode_bit(bc, &bc->probs[node], bit);
+            node = node << 1 | bit;
+        }
+        if (bits) bits[i] = (float)-log2(p_sym);
+    }
+    for (int i = 0; i < 5; i++) shift_low(bc);
+
+    PP_PROBE5(arith_end, bc->image_id, 0, input_len, bc->out_pos, 0);
+    return bc->out_pos;
+}
+
+// Reads past the end as zeros; only corrupt input gets that far
+static uint8_t read_byte(bittree_coder* bc) {
+    return bc->in_pos < bc->in_len ? bc->in_buf[bc->in_pos++] : 0;
+}
+
+static int decode_bit(bittree_coder* bc, uint16_t* p) {
+    uint32_t bound = (bc->range >> BITTREE_PROB_BITS) * *p;
+    int bit;
+    if (bc->code < bound) {
+        bc->range = bound;
+        *p += (PROB_ONE - *p) >> BITTREE_ADAPT_SHIFT;
+        bit = 0;
+    } else {
+        bc->code -= bound;
+        bc->range -= bound;
+        *p -= *p >> BITTREE_ADAPT_SHIFT;
+        bit = 1;
+    }
+    while (bc->range < TOP) {
+        bc->range <<= 8;
+        bc->code = bc->code << 8 | read_byte(bc);
+    }
+    return bit;
+}
+
+size_t bittree_decode(bittree_coder* bc, const unsigned char* input, size_t input_len,
+                      unsigned char* output, size_t output_capacity) {
+    PP_PROBE3(arith_start, bc->image_id, 1, input_len);
+    model_init(bc);
+    bc->in_buf = input;
+    bc->in_len = input_len;
+    bc->in_pos = 0;
+    bc->range = 0xFFFFFFFFu;
+    bc->code = 0;
+    for (int i = 0; i < 5; i++) bc->code = bc->code << 8 | read_byte(bc);
+
+    for (size_t i = 0; i < output_capacity; i++) {
+        unsigned node = 1;
+        while (node < 256) node = node << 1 | decode_bit(bc, &bc->probs[node]);
+        output[i] = (unsigned char)node;
+    }
+    PP_PROBE5(arith_end, bc->image_id, 1, input_len, output_capacity, 0);
+    return output_capacity;
+}
@@ -0,0 +1,49 @@
+// bittree.h -- binary adaptive range coder over a 255-node bit tree
+#ifndef BITTREE_H
+#define BITTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Each byte is coded MSB first as 8 binary decisions, each with the
+// probability held by the node its prefix reaches (node 1 is the root,
+// node n's children are 2n and 2n + 1). Probabilities are 12-bit and move
+// 1/32 of the way toward every coded bit, so a decision costs a multiply,
+// a compare and a shift: no division, cumulative table or symbol search.
+#define BITTREE_PROB_BITS 12
+#define BITTREE_ADAPT_SHIFT 5
+
+// All coder state lives here, one per thread, as for arith_coder
+typedef struct {
+    uint16_t probs[256];        // P(bit = 0) of node n in probs[n]
+
+    uint64_t low;
+    uint32_t range;
+    uint32_t code;
+    uint8_t cache;              // byte held back until carries settle
+    uint64_t cache_size;
+
+    unsigned char* out_buf;
+    size_t out_pos;
+    size_t out_capacity;
+
+    const unsigned char* in_buf;
+    size_t in_pos;
+    size_t in_len;
+
+    uint64_t image_id;          // passed to the probes, set by the caller
+} bittree_coder;
+
+// Returns the length of the whole coded stream, as arith_encode() does: a
+// result above output_capacity means the output did not fit. A decision
+// costs up to about 7 bits, so adversarial input can grow several fold. If
+// bits is not NULL it receives each byte's cost in bits (input_len
+// floats), as arith_encode_costs() does. Diagnostic.
+size_t bittree_encode(bittree_coder* bc, const unsigned char* input, size_t input_len,
+                      unsigned char* output, size_t output_capacity, float* bits);
+
+// Decodes exactly output_capacity bytes and returns that count
+size_t bittree_decode(bittree_coder* bc, const unsigned char* input, size_t input_len,
+                      unsigned char* output, size_t output_capacity);
+
+#endif // BITTREE_H
@@ -0,0 +1,1093 @@
+// codec.c -- LOCO-I prediction, RLE and arithmetic coding of RGB images
+#include "codec.h"
+#include "arith.h"
+#include "bittree.h"
+#include "arena.h"
+#include "probes.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const char* const pp_stage_names[PP_STAGE_COUNT] = {
+    "split", "predict", "rle", "entropy",
+    "entropy_dec", "rle_dec", "unpredict", "interleave",
+};
+
+const char* const pp_predictor_names[PP_PRED_COUNT] = { "none", "left", "med" };
+const char* const pp_rle_names[PP_RLE_COUNT] = { "none", "pairs", "packbits" };
+const char* const pp_entropy_names[PP_ENTROPY_COUNT] = { "none", "arith", "classes", "bittree" };
+
+// Points on the measured speed/size frontier (benchmark --pareto); every
+// other pipeline is both slower and larger on photographs and synthetic
+// images alike, so there are only as many levels as frontier points. An
+// entropy coder dominates run time, so the fast end stores the RLE
+// output. PackBits beats pair RLE on both axes, so pairs are only written
+// on request. The bit-tree coder is faster than the arithmetic and class
+// coders and, adapting within a few dozen symbols, denser than either on
+// photographs, so it does all the entropy coding; PackBits in front of it
+// trades a few percent of ratio for speed on flat content. The skip map
+// spares the coder the flat areas that dominate its time on synthetic and
+// astronomical images.
+static const pp_options presets[PP_EFFORT_MAX] = {
+    { PP_PRED_NONE, PP_RLE_PACKBITS, PP_ENTROPY_NONE,    0 },                     // 1
+    { PP_PRED_MED,  PP_RLE_PACKBITS, PP_ENTROPY_NONE,    0 },                     // 2
+    { PP_PRED_MED,  PP_RLE_PACKBITS, PP_ENTROPY_BITTREE, PP_FLAG_SKIP_BLOCKS },   // 3
+    { PP_PRED_MED,  PP_RLE_NONE,     PP_ENTROPY_BITTREE, PP_FLAG_SKIP_BLOCKS },   // 4
+};
+
+pp_options pp_preset(int effort) {
+    if (effort < PP_EFFORT_MIN) effort = PP_EFFORT_MIN;
+    if (effort > PP_EFFORT_MAX) effort = PP_EFFORT_MAX;
+    return presets[effort - 1];
+}
+
+// The only pipeline before pp_options existed; its files carry PP_MAGIC
+static const pp_options legacy_options = { PP_PRED_MED, PP_RLE_PAIRS, PP_ENTROPY_ARITH, 0 };
+
+static int is_legacy(const pp_options* o) {
+    return o->predictor == legacy_options.predictor && o->rle == legacy_options.rle &&
+           o->entropy == legacy_options.entropy && o->flags == 0;
+}
+
+static int valid_options(const pp_options* o) {
+    return o->predictor < PP_PRED_COUNT && o->rle < PP_RLE_COUNT && o->entropy < PP_ENTROPY_COUNT &&
+           (o->flags & ~PP_FLAG_SKIP_BLOCKS) == 0;
+}
+
+int loco_predict(int a, int b, int c) {
+    int p = a + b - c;
+    if (c >= (a > b ? a : b)) return (a < b) ? a : b;
+    else if (c <= (a < b ? a : b)) return (a > b) ? a : b;
+    else return p;
+}
+
+void compute_residuals(const uint8_t* src, const uint8_t* above, int width, int height, uint8_t* residuals) {
+    for (int y = 0; y < height; y++) {
+        const uint8_t* cur = src + (size_t)y * width;
+        const uint8_t* up = y > 0 ? cur - width : above;
+        for (int x = 0; x < width; x++) {
+            int a = x > 0 ? cur[x - 1] : 0;
+            int b = up ? up[x] : 0;
+            int c = (x > 0 && up) ? up[x - 1] : 0;
+
+            int pred = loco_predict(a, b, c);
+            int res = (int)cur[x] - pred;
+            residuals[(size_t)y * width + x] = (uint8_t)res;
+        }
+    }
+}
+
+void inverse_predict_loco_i(const uint8_t* resid, const uint8_t* above, uint8_t* out, int wid, int ht) {
+    for (int y=0; y < ht; y++) {
+        uint8_t* cur = out + (size_t)y * wid;
+        const uint8_t* up = y > 0 ? cur - wid : above;
+        for (int x=0; x < wid; x++) {
+            int a = x > 0 ? cur[x - 1] : 0;
+            int b = up ? up[x] : 0;
+            int c = (x > 0 && up) ? up[x - 1] : 0;
+            int pred = loco_predict(a, b, c);
+
+            int val = (pred + resid[(size_t)y * wid + x]) & 0xFF;
+            cur[x] = (uint8_t)val;
+        }
+    }
+}
+
+// Left neighbour; the first column predicts from the row above
+static void left_residuals(const uint8_t* src, const uint8_t* above, int width, int height, uint8_t* residuals) {
+    for (int y = 0; y < height; y++) {
+        const uint8_t* cur = src + (size_t)y * width;
+        const uint8_t* up = y > 0 ? cur - width : above;
+        uint8_t* res = residuals + (size_t)y * width;
+        res[0] = (uint8_t)(cur[0] - (up ? up[0] : 0));
+        for (int x = 1; x < width; x++) res[x] = (uint8_t)(cur[x] - cur[x - 1]);
+    }
+}
+
+static void left_unpredict(const uint8_t* resid, const uint8_t* above, uint8_t* out, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        uint8_t* cur = out + (size_t)y * width;
+        const uint8_t* up = y > 0 ? cur - width : above;
+        const uint8_t* res = resid + (size_t)y * width;
+        cur[0] = (uint8_t)(res[0] + (up ? up[0] : 0));
+        for (int x = 1; x < width; x++) cur[x] = (uint8_t)(res[x] + cur[x - 1]);
+    }
+}
+
+static void predict(int predictor, const uint8_t* src, const uint8_t* above, int width, int height, uint8_t* residuals) {
+    if (predictor == PP_PRED_MED) compute_residuals(src, above, width, height, residuals);
+    else if (predictor == PP_PRED_LEFT) left_residuals(src, above, width, height, residuals);
+    else memcpy(residuals, src, (size_t)width * height);
+}
+
+static void unpredict(int predictor, const uint8_t* resid, const uint8_t* above, uint8_t* out, int width, int height) {
+    if (predictor == PP_PRED_MED) inverse_predict_loco_i(resid, above, out, width, height);
+    else if (predictor == PP_PRED_LEFT) left_unpredict(resid, above, out, width, height);
+    else memcpy(out, resid, (size_t)width * height);
+}
+
+// Zero-block skip map (PP_FLAG_SKIP_BLOCKS). Blocks are clipped at the
+// right and bottom edges of the plane; the map has one bit per block, set
+// if the block is coded, row-major and LSB first.
+#define SKIP_BLOCK 16
+
+static size_t skip_map_bytes(int width, int rows) {
+    size_t blocks = (size_t)((width + SKIP_BLOCK - 1) / SKIP_BLOCK) * ((rows + SKIP_BLOCK - 1) / SKIP_BLOCK);
+    return (blocks + 7) / 8;
+}
+
+static int skip_coded(const uint8_t* map, int blocks_x, int y, int x) {
+    size_t b = (size_t)(y / SKIP_BLOCK) * blocks_x + x / SKIP_BLOCK;
+    return map[b >> 3] >> (b & 7) & 1;
+}
+
+static int all_zero(const uint8_t* p, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(p + i)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF) return 0;
+#endif
+    for (; i < n; i++) {
+        if (p[i]) return 0;
+    }
+    return 1;
+}
+
+// Writes the map of one residual plane followed by the residuals of its
+// coded blocks, in row order. Returns the bytes written, at most
+// skip_map_bytes() + width * rows.
+static size_t skip_gather(const uint8_t* res, int width, int rows, uint8_t* out) {
+    int blocks_x = (width + SKIP_BLOCK - 1) / SKIP_BLOCK;
+    size_t map_len = skip_map_bytes(width, rows);
+    uint8_t* map = out;
+    memset(map, 0, map_len);
+    for (int y = 0; y < rows; y++) {
+        const uint8_t* row = res + (size_t)y * width;
+        size_t b = (size_t)(y / SKIP_BLOCK) * blocks_x;
+        for (int x = 0; x < width; x += SKIP_BLOCK, b++) {
+            int n = width - x < SKIP_BLOCK ? width - x : SKIP_BLOCK;
+            if (!all_zero(row + x, n)) map[b >> 3] |= (uint8_t)(1u << (b & 7));
+        }
+    }
+
+    size_t pos = map_len;
+    for (int y = 0; y < rows; y++) {
+        const uint8_t* row = res + (size_t)y * width;
+        for (int x = 0; x < width; x += SKIP_BLOCK) {
+            int n = width - x < SKIP_BLOCK ? width - x : SKIP_BLOCK;
+            if (!skip_coded(map, blocks_x, y, x)) continue;
+            memcpy(out + pos, row + x, n);
+            pos += n;
+        }
+    }
+    return pos;
+}
+
+// Inverse of skip_gather(): fills the plane, zeroing skipped blocks.
+// Returns the bytes read, or 0 if len is too short.
+static size_t skip_scatter(const uint8_t* in, size_t len, int width, int rows, uint8_t* res) {
+    int blocks_x = (width + SKIP_BLOCK - 1) / SKIP_BLOCK;
+    size_t pos = skip_map_bytes(width, rows);
+    if (pos > len) return 0;
+    for (int y = 0; y < rows; y++) {
+        uint8_t* row = res + (size_t)y * width;
+        for (int x = 0; x < width; x += SKIP_BLOCK) {
+            size_t n = width - x < SKIP_BLOCK ? width - x : SKIP_BLOCK;
+            if (!skip_coded(in, blocks_x, y, x)) {
+                memset(row + x, 0, n);
+                continue;
+            }
+            if (n > len - pos) return 0;
+            memcpy(row + x, in + pos, n);
+            pos += n;
+        }
+    }
+    return pos;
+}
+
+// unpredict() given the plane's skip map. Inside a skipped block every
+// pixel is its prediction, and MED(a, b, c) is b when a == c and a when
+// b == c, so a row segment whose left neighbour matches the pixel above
+// it is a copy of the row above; on the top row it repeats its left
+// neighbour. Left prediction repeats the left neighbour everywhere.
+static void unpredict_skip(int predictor, const uint8_t* resid, const uint8_t* above, uint8_t* out,
+                           int width, int height, const uint8_t* map) {
+    if (predictor == PP_PRED_NONE) {
+        memcpy(out, resid, (size_t)width * height);
+        return;
+    }
+    int blocks_x = (width + SKIP_BLOCK - 1) / SKIP_BLOCK;
+    for (int y = 0; y < height; y++) {
+        uint8_t* cur = out + (size_t)y * width;
+        const uint8_t* up = y > 0 ? cur - width : above;
+        const uint8_t* res = resid + (size_t)y * width;
+        for (int x0 = 0; x0 < width; x0 += SKIP_BLOCK) {
+            int x1 = width - x0 < SKIP_BLOCK ? width : x0 + SKIP_BLOCK;
+            if (!skip_coded(map, blocks_x, y, x0)) {
+                if (predictor == PP_PRED_MED && up && (x0 == 0 || cur[x0 - 1] == up[x0 - 1])) {
+                    memcpy(cur + x0, up + x0, x1 - x0);
+                    continue;
+                }
+                if (x0 > 0 && (predictor == PP_PRED_LEFT || !up)) {
+                    memset(cur + x0, cur[x0 - 1], x1 - x0);
+                    continue;
+                }
+            }
+            for (int x = x0; x < x1; x++) {
+                int a = x > 0 ? cur[x - 1] : 0;
+                int b = up ? up[x] : 0;
+                int pred;
+                if (predictor == PP_PRED_LEFT) pred = x > 0 ? a : b;
+                else pred = loco_predict(a, b, (x > 0 && up) ? up[x - 1] : 0);
+                cur[x] = (uint8_t)(pred + res[x]);
+            }
+        }
+    }
+}
+
+size_t rle_encode_into(const unsigned char* data, size_t len, unsigned char* out) {
+    size_t pos = 0, i = 0;
+    while (i < len) {
+        size_t run = 1;
+        while (i + run < len && data[i] == data[i + run] && run < 255) run++;
+        out[pos++] = (unsigned char)run;
+        out[pos++] = data[i];
+        i += run;
+    }
+    return pos;
+}
+
+void rle_decode_into(const unsigned char* data, size_t len, unsigned char* out, size_t out_len) {
+    size_t pos = 0, i = 0;
+    while (i + 1 < len && pos < out_len) {
+        unsigned char run = data[i++];
+        unsigned char val = data[i++];
+        for (int j = 0; j < run && pos < out_len; j++) {
+            out[pos++] = val;
+        }
+    }
+
+    while (pos < out_len) {
+        out[pos++] = 0;
+    }
+}
+
+unsigned char* rle_encode(const unsigned char* data, size_t len, size_t* out_len) {
+    unsigned char* out = malloc(len * 2 + 1024);
+    if (!out) return NULL;
+    *out_len = rle_encode_into(data, len, out);
+    return out;
+}
+
+unsigned char* rle_decode(const unsigned char* data, size_t len, size_t out_len) {
+    unsigned char* out = malloc(out_len);
+    if (!out) return NULL;
+    rle_decode_into(data, len, out, out_len);
+    return out;
+}
+
+// Length of the run of data[0] starting at data, at most len
+static size_t run_length(const unsigned char* data, size_t len) {
+    size_t n = 1;
+#ifdef __SSE2__
+    __m128i v = _mm_set1_epi8((char)data[0]);
+    for (; n + 16 <= len; n += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_loadu_si128((const __m128i*)(data + n))));
+        if (mask != 0xFFFF) return n + __builtin_ctz(~mask);
+    }
+#endif
+    while (n < len && data[n] == data[0]) n++;
+    return n;
+}
+
+// Offset of the first run of PACKBITS_MIN_RUN equal bytes, or len
+#define PACKBITS_MIN_RUN 3
+static size_t next_run(const unsigned char* data, size_t len) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 18 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(data + i + 2));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, b), _mm_cmpeq_epi8(b, c)));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i + PACKBITS_MIN_RUN <= len; i++) {
+        if (data[i] == data[i + 1] && data[i] == data[i + 2]) return i;
+    }
+    return len;
+}
+
+size_t packbits_encode_into(const unsigned char* data, size_t len, unsigned char* out) {
+    size_t pos = 0, i = 0;
+    while (i < len) {
+        size_t lit = next_run(data + i, len - i);
+        while (lit > 0) {
+            size_t n = lit < 128 ? lit : 128;
+            out[pos++] = (unsigned char)(n - 1);
+            memcpy(out + pos, data + i, n);
+            pos += n;
+            i += n;
+            lit -= n;
+        }
+        if (i == len) break;
+
+        size_t run = run_length(data + i, len - i);
+        if (run <= 128) {
+            out[pos++] = (unsigned char)(0x80 + run - 2);
+        } else {
+            out[pos++] = 0xFF;
+            for (size_t v = run - 129; ; v >>= 7) {
+                out[pos++] = (unsigned char)((v & 0x7F) | (v >= 0x80 ? 0x80 : 0));
+                if (v < 0x80) break;
+            }
+        }
+        out[pos++] = data[i];
+        i += run;
+    }
+    return pos;
+}
+
+size_t packbits_decode_into(const unsigned char* data, size_t len, unsigned char* out, size_t out_len) {
+    size_t pos = 0, i = 0;
+    while (i < len) {
+        unsigned h = data[i++];
+        if (h < 0x80) {
+            size_t n = h + 1;
+            if (n > len - i || n > out_len - pos) return 0;
+            memcpy(out + pos, data + i, n);
+            i += n;
+            pos += n;
+            continue;
+        }
+        size_t run = h - 0x80 + 2;
+        if (h == 0xFF) {
+            size_t v = 0;
+            int shift = 0;
+            unsigned b;
+            do {
+                if (i == len || shift > 56) return 0;
+                b = data[i++];
+                v |= (size_t)(b & 0x7F) << shift;
+                shift += 7;
+            } while (b & 0x80);
+            run = v + 129;
+        }
+        if (i == len || run > out_len - pos) return 0;
+        memset(out + pos, data[i++], run);
+        pos += run;
+    }
+    return pos;
+}
+
+struct pp_context {
+    arith_coder ac;
+    bittree_coder bt;
+    arena mem;
+
+    // Carved from mem for the strip geometry of the current image
+    uint8_t* planes;
+    uint8_t* residuals;
+    uint8_t* skip;          // skip maps and coded blocks' residuals
+    unsigned char* rle;
+    unsigned char* coded;
+    size_t skip_cap;
+    size_t rle_cap;
+    size_t coded_cap;
+
+    pp_stats* stats;
+    double stage_start;
+    uint64_t image_id;      // probe argument for the current call
+};
+
+static uint64_t next_image_id;
+
+pp_context* pp_context_create(int huge_pages) {
+    pp_context* ctx = calloc(1, sizeof(pp_context));
+    if (ctx) ctx->mem.huge_pages = huge_pages;
+    return ctx;
+}
+
+void pp_context_free(pp_context* ctx) {
+    if (!ctx) return;
+    arena_release(&ctx->mem);
+    free(ctx);
+}
+
+void pp_set_stats(pp_context* ctx, pp_stats* stats) {
+    ctx->stats = stats;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// in and out are the stage's byte counts as far as they are known up front;
+// out is 0 where only stage_end() can tell
+static void stage_begin(pp_context* ctx, pp_stage stage, int y0, uint64_t in, uint64_t out) {
+    (void)y0, (void)in, (void)out;      // only the probe reads them
+    PP_PROBE5(stage_start, ctx->image_id, (int)stage, y0, in, out);
+    if (!ctx->stats) return;
+    if (ctx->stats->hook) ctx->stats->hook(ctx->stats->hook_arg, stage, 0);
+    ctx->stage_start = now_seconds();
+}
+
+static void stage_end(pp_context* ctx, pp_stage stage, uint64_t in, uint64_t out) {
+    PP_PROBE4(stage_end, ctx->image_id, (int)stage, in, out);
+    if (!ctx->stats) return;
+    ctx->stats->seconds[stage] += now_seconds() - ctx->stage_start;
+    ctx->stats->bytes_in[stage] += in;
+    ctx->stats->bytes_out[stage] += out;
+    if (ctx->stats->hook) ctx->stats->hook(ctx->stats->hook_arg, stage, 1);
+}
+
+// The bit-tree coder has no rescales or underflows to count
+static void count_coder_events(pp_context* ctx, pp_stage stage, int entropy) {
+    if (!ctx->stats || entropy == PP_ENTROPY_BITTREE) return;
+    ctx->stats->rescales[stage] += ctx->ac.rescales;
+    ctx->stats->underflows[stage] += ctx->ac.underflows;
+}
+
+// Lays out every stage buffer for strips of width x strip_rows in the
+// context arena. The arena only grows, so once a context has seen its
+// largest geometry the codec does no allocation at all.
+static int layout(pp_context* ctx, int width, int strip_rows) {
+    size_t strip_px = (size_t)width * strip_rows;
+    size_t plane_len = strip_px + width;
+    ctx->skip_cap = 3 * (strip_px + skip_map_bytes(width, strip_rows));
+    ctx->rle_cap = 2 * ctx->skip_cap;           // one run/value pair per byte
+    ctx->coded_cap = ctx->rle_cap + 4096;
+    size_t need = 3 * plane_len + 3 * strip_px + ctx->skip_cap + ctx->rle_cap + ctx->coded_cap + 5 * 64;
+    if (arena_reserve(&ctx->mem, need) != 0) return -1;
+    if (ctx->stats && ctx->mem.size > ctx->stats->arena_bytes) ctx->stats->arena_bytes = ctx->mem.size;
+
+    ctx->planes = arena_alloc(&ctx->mem, 3 * plane_len);
+    ctx->residuals = arena_alloc(&ctx->mem, 3 * strip_px);
+    ctx->skip = arena_alloc(&ctx->mem, ctx->skip_cap);
+    ctx->rle = arena_alloc(&ctx->mem, ctx->rle_cap);
+    ctx->coded = arena_alloc(&ctx->mem, ctx->coded_cap);
+    return 0;
+}
+
+// Each channel plane holds one context row followed by a strip's rows
+static uint8_t* plane_row0(uint8_t* planes, int c, size_t plane_len) {
+    return planes + c * plane_len;
+}
+
+// A strip record whose rle_len carries this bit holds its 3 * px
+// residuals as they are: the strip would not have shrunk by at least
+// STORE_MIN_GAIN percent, so the coder was skipped or its output dropped.
+// Expansion is bounded by the 16-byte record header per strip.
+#define STRIP_STORED (1ull << 63)
+#define STORE_MIN_GAIN 2
+
+// Order-0 entropy of len symbols in bytes. The order-0 arithmetic coder
+// lands close to it, so its gain is known before paying for the coder.
+// The class and bit-tree coders adapt to local statistics that an order-0
+// estimate does not see, so they are judged on their output instead.
+static size_t estimate_coded(const unsigned char* data, size_t len) {
+    size_t hist[256] = {0};
+    for (size_t i = 0; i < len; i++) hist[data[i]]++;
+    double bits = 0;
+    for (int s = 0; s < 256; s++) {
+        if (hist[s]) bits -= hist[s] * log2((double)hist[s] / len);
+    }
+    return (size_t)(bits / 8);
+}
+
+static int below_min_gain(size_t coded, size_t raw) {
+    return coded * 100 >= raw * (100 - STORE_MIN_GAIN);
+}
+
+// Adds each coded symbol's cost (8 bits if stored) to the pixels of a
+// strip, given the symbols and the px-pixel channel planes they code
+static void map_strip_bits(int rle, const unsigned char* sym, size_t len, const float* costs, size_t px,
+                           float* map) {
+    size_t j = 0;       // residual byte, channel-major
+    for (size_t i = 0; i < len; i++) {
+        float bits = costs ? costs[i] : 8.0f;
+        if (rle == PP_RLE_PACKBITS) {
+            // Literal bytes pay for themselves and share their control
+            // byte; a run's control, length and value share its pixels
+            unsigned h = sym[i];
+            if (h < 0x80) {
+                for (unsigned k = 0; k <= h; k++) {
+                    i++;
+                    map[j++ % px] += (costs ? costs[i] : 8.0f) + bits / (h + 1);
+                }
+                continue;
+            }
+            size_t run = h - 0x80 + 2;
+            if (h == 0xFF) {
+                size_t v = 0;
+                int shift = 0;
+                do {
+                    i++;
+                    bits += costs ? costs[i] : 8.0f;
+                    v |= (size_t)(sym[i] & 0x7F) << shift;
+                    shift += 7;
+                } while (sym[i] & 0x80);
+                run = v + 129;
+            }
+            i++;
+            bits += costs ? costs[i] : 8.0f;
+            for (size_t k = 0; k < run; k++) map[j++ % px] += bits / run;
+            continue;
+        }
+        if (rle != PP_RLE_PAIRS) {
+            map[j++ % px] += bits;
+            continue;
+        }
+        // A (run, value) pair: both symbols pay for run residuals
+        bits += costs ? costs[i + 1] : 8.0f;
+        size_t run = sym[i++];
+        for (size_t k = 0; k < run; k++) map[j++ % px] += bits / run;
+    }
+}
+
+// Moves the bits of a skip-mapped strip, one float per byte of the
+// gathered stream, onto its pixels: a plane's map is shared over the
+// plane and coded blocks' bytes go to their own pixels
+static void map_skip_bits(const uint8_t* sym, const float* bits, int width, int rows, float* map) {
+    int blocks_x = (width + SKIP_BLOCK - 1) / SKIP_BLOCK;
+    size_t px = (size_t)width * rows, map_len = skip_map_bytes(width, rows);
+    size_t pos = 0;
+    for (int c = 0; c < 3; c++) {
+        const uint8_t* skip = sym + pos;
+        float shared = 0;
+        for (size_t i = 0; i < map_len; i++) shared += bits[pos++];
+        for (size_t i = 0; i < px; i++) map[i] += shared / px;
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < width; x += SKIP_BLOCK) {
+                if (!skip_coded(skip, blocks_x, y, x)) continue;
+                int x1 = width - x < SKIP_BLOCK ? width : x + SKIP_BLOCK;
+                for (int k = x; k < x1; k++) map[(size_t)y * width + k] += bits[pos++];
+            }
+        }
+    }
+}
+
+int pp_encode(pp_context* ctx, const image_view* img, int strip_rows, const pp_options* opts,
+              FILE* f, uint64_t* compressed_bytes) {
+    int width = img->width, height = img->height;
+    if (strip_rows <= 0 || strip_rows > height) strip_rows = height;
+    pp_options o = opts ? *opts : pp_preset(PP_EFFORT_DEFAULT);
+    if (!valid_options(&o)) return -1;
+    int skip = (o.flags & PP_FLAG_SKIP_BLOCKS) != 0;
+
+    pp_context* own = NULL;
+    if (!ctx) ctx = own = pp_context_create(0);
+    if (!ctx || layout(ctx, width, strip_rows) != 0) {
+        pp_context_free(own);
+        return -1;
+    }
+    ctx->image_id = __atomic_fetch_add(&next_image_id, 1, __ATOMIC_RELAXED);
+    ctx->ac.image_id = ctx->bt.image_id = ctx->image_id;
+    PP_PROBE4(image_start, ctx->image_id, 0, width, height);
+
+    size_t strip_px = (size_t)width * strip_rows;
+    size_t plane_len = strip_px + width;
+    uint8_t* planes = ctx->planes;
+    uint8_t* residuals = ctx->residuals;
+
+    int channels = 3;
+    fwrite(is_legacy(&o) ? PP_MAGIC : PP_MAGIC_OPTIONS, 1, 4, f);
+    fwrite(&width, sizeof(int), 1, f);
+    fwrite(&height, sizeof(int), 1, f);
+    fwrite(&channels, sizeof(int), 1, f);
+    fwrite(&strip_rows, sizeof(int), 1, f);
+    uint64_t total = 4 + 4 * sizeof(int);
+    if (!is_legacy(&o)) {
+        fwrite(&o, sizeof(o), 1, f);
+        total += sizeof(o);
+    }
+
+    int ri = img->bgr ? 2 : 0, bi = img->bgr ? 0 : 2;
+    int ok = 1;
+    for (int y0 = 0; y0 < height && ok; y0 += strip_rows) {
+        int rows = height - y0 < strip_rows ? height - y0 : strip_rows;
+        size_t px = (size_t)width * rows;
+
+        // Separate channels, carrying the previous strip's last row as context
+        stage_begin(ctx, PP_STAGE_SPLIT, y0, 3 * px, 3 * px);
+        for (int c = 0; c < 3; c++) {
+            uint8_t* p = plane_row0(planes, c, plane_len);
+            if (y0 > 0) memcpy(p, p + strip_px, width);
+        }
+        uint8_t* r_chan = plane_row0(planes, 0, plane_len) + width;
+        uint8_t* g_chan = plane_row0(planes, 1, plane_len) + width;
+        uint8_t* b_chan = plane_row0(planes, 2, plane_len) + width;
+        for (int y = 0; y < rows; y++) {
+            const unsigned char* row = img->row0 + (ptrdiff_t)(y0 + y) * img->stride;
+            size_t base = (size_t)y * width;
+            for (int x = 0; x < width; x++) {
+                r_chan[base + x] = row[3*x + ri];
+                g_chan[base + x] = row[3*x + 1];
+                b_chan[base + x] = row[3*x + bi];
+            }
+        }
+        image_release_rows(img, y0, y0 + rows);
+        stage_end(ctx, PP_STAGE_SPLIT, 3 * px, 3 * px);
+
+        // With the skip map, only coded blocks go on to the later stages
+        stage_begin(ctx, PP_STAGE_PREDICT, y0, 3 * px, skip ? 0 : 3 * px);
+        const unsigned char* sym = residuals;
+        size_t sym_len = 3 * px;
+        for (int c = 0; c < 3; c++) {
+            uint8_t* p = plane_row0(planes, c, plane_len);
+            predict(o.predictor, p + width, y0 > 0 ? p : NULL, width, rows, residuals + c * px);
+        }
+        if (skip) {
+            sym = ctx->skip;
+            sym_len = 0;
+            for (int c = 0; c < 3; c++) sym_len += skip_gather(residuals + c * px, width, rows, ctx->skip + sym_len);
+        }
+        stage_end(ctx, PP_STAGE_PREDICT, 3 * px, sym_len);
+
+        // Skipped stages pass their input through untouched
+        const unsigned char* rle = sym;
+        size_t rle_len = sym_len;
+        if (o.rle != PP_RLE_NONE) {
+            stage_begin(ctx, PP_STAGE_RLE, y0, sym_len, 0);
+            rle_len = o.rle == PP_RLE_PAIRS ? rle_encode_into(sym, sym_len, ctx->rle)
+                                            : packbits_encode_into(sym, sym_len, ctx->rle);
+            rle = ctx->rle;
+            stage_end(ctx, PP_STAGE_RLE, sym_len, rle_len);
+        }
+
+        int coder = o.entropy != PP_ENTROPY_NONE;
+        int stored = o.entropy == PP_ENTROPY_ARITH && below_min_gain(estimate_coded(rle, rle_len), 3 * px);
+        float* bit_map = ctx->stats ? ctx->stats->bit_map : NULL;
+        float* costs = NULL;
+        if (bit_map && coder && !stored && !(costs = malloc(rle_len * sizeof(float)))) {
+            ok = 0;
+            break;
+        }
+
+        const unsigned char* coded = rle;
+        size_t arith_len = rle_len;
+        if (coder && !stored) {
+            stage_begin(ctx, PP_STAGE_ENTROPY, y0, rle_len, 0);
+            size_t cap = ctx->coded_cap;
+            if (o.entropy == PP_ENTROPY_CLASSES) {
+                arith_len = arith_encode_classes(&ctx->ac, rle, rle_len, ctx->coded, cap, costs);
+            } else if (o.entropy == PP_ENTROPY_BITTREE) {
+                arith_len = bittree_encode(&ctx->bt, rle, rle_len, ctx->coded, cap, costs);
+            } else {
+                arith_len = costs ? arith_encode_costs(&ctx->ac, rle, rle_len, ctx->coded, cap, costs)
+                                  : arith_encode(&ctx->ac, rle, rle_len, ctx->coded, cap);
+            }
+            coded = ctx->coded;
+            stage_end(ctx, PP_STAGE_ENTROPY, rle_len, arith_len);
+            count_coder_events(ctx, PP_STAGE_ENTROPY, o.entropy);
+            // A coder that ran out of room reports more than cap
+            stored = arith_len > cap || below_min_gain(arith_len, 3 * px);
+        }
+        stored |= arith_len > 3 * px;
+        uint64_t lens[2] = { rle_len, arith_len };
+        if (stored) {
+            coded = residuals;
+            arith_len = 3 * px;
+            lens[0] = STRIP_STORED | arith_len;
+            lens[1] = arith_len;
+        }
+        if (ctx->stats) {
+            ctx->stats->strips++;
+            ctx->stats->stored_strips += stored;
+        }
+        float* sym_bits = NULL;
+        if (bit_map && stored) {
+            map_strip_bits(PP_RLE_NONE, residuals, 3 * px, NULL, px, bit_map + (size_t)y0 * width);
+        } else if (bit_map && !skip) {
+            map_strip_bits(o.rle, rle, rle_len, costs, px, bit_map + (size_t)y0 * width);
+        } else if (bit_map && (sym_bits = calloc(sym_len, sizeof(float)))) {
+            map_strip_bits(o.rle, rle, rle_len, costs, sym_len, sym_bits);
+            map_skip_bits(sym, sym_bits, width, rows, bit_map + (size_t)y0 * width);
+        } else if (bit_map) {
+            ok = 0;
+        }
+        free(sym_bits);
+        free(costs);
+        if (!ok) break;
+
+        if (fwrite(lens, sizeof(uint64_t), 2, f) != 2 || fwrite(coded, 1, arith_len, f) != arith_len) ok = 0;
+        total += sizeof(lens) + arith_len;
+    }
+
+    PP_PROBE4(image_end, ctx->image_id, 0, ok, total);
+    pp_context_free(own);
+    if (compressed_bytes) *compressed_bytes = total;
+    return ok ? 0 : -1;
+}
+
+// loco_predict() without branches, so the row loop vectorises
+static inline int med_branchless(int a, int b, int c) {
+    int mx = a > b ? a : b, mn = a < b ? a : b;
+    int p = a + b - c;
+    p = c >= mx ? mn : p;
+    return c <= mn ? mx : p;
+}
+
+// Residuals of one channel row, any predictor; up is NULL on the top row
+static void residual_row(int predictor, const uint8_t* cur, const uint8_t* up, int width, uint8_t* out) {
+    if (predictor == PP_PRED_NONE) {
+        memcpy(out, cur, width);
+    } else if (predictor == PP_PRED_LEFT) {
+        out[0] = (uint8_t)(cur[0] - (up ? up[0] : 0));
+        for (int x = 1; x < width; x++) out[x] = (uint8_t)(cur[x] - cur[x - 1]);
+    } else if (!up) {
+        for (int x = 0; x < width; x++) out[x] = (uint8_t)(cur[x] - (x > 0 ? cur[x - 1] : 0));
+    } else {
+        out[0] = (uint8_t)(cur[0] - up[0]);
+        for (int x = 1; x < width; x++) out[x] = (uint8_t)(cur[x] - med_branchless(cur[x - 1], up[x], up[x - 1]));
+    }
+}
+
+// The adaptive model halves its counts once they total 2^15 and keeps
+// every symbol at least 1, so its frequency total averages about 3/4 of
+// that and no symbol gets cheaper than its count allows. Cost per symbol
+// is modelled as -log2(p * (1 - 256/T) + 1/T) with T that average.
+#define ESTIMATE_MODEL_TOTAL 24576.0
+#define ESTIMATE_CLASS_TOTAL 768.0      // the same for the 2^10 class model
+
+// The three channel planes of a strip share one model that adapts only
+// as fast as it rescales, so the real cost lies between the per-channel
+// and the pooled entropy. Weight of the per-channel end, fitted with
+// algo estimate --verify on natural and synthetic images.
+#define ESTIMATE_CHANNEL_WEIGHT 0.6
+
+// Rows per sampled band: enough for the longest RLE run on narrow images
+static int band_rows(int width) {
+    return width >= 255 ? 1 : (255 + width - 1) / width;
+}
+
+// Order-0 bits of a histogram of n symbols under an adaptive model whose
+// frequency total averages t, as above
+static double model_bits(const uint64_t* counts, int n, double t) {
+    uint64_t total = 0;
+    for (int s = 0; s < n; s++) total += counts[s];
+    double bits = 0;
+    for (int s = 0; s < n; s++) {
+        if (!counts[s]) continue;
+        double p = (double)counts[s] / total;
+        bits -= counts[s] * log2(p * (1 - n / t) + 1 / t);
+    }
+    return bits;
+}
+
+// PP_ENTROPY_CLASSES: the class model adapts within about one band of
+// symbols, so each band's channel is costed against its own class
+// histogram, plus k bypass bits per symbol of class k
+static double class_bits(const uint8_t* sym, size_t len) {
+    uint32_t hist[256] = {0};
+    for (size_t i = 0; i < len; i++) hist[sym[i]]++;
+    uint64_t counts[9] = {0}, bypass = 0;
+    for (int s = 0; s < 256; s++) {
+        int v = (signed char)s;
+        int k = v ? 32 - __builtin_clz((unsigned)(v < 0 ? -v : v)) : 0;
+        counts[k] += hist[s];
+        bypass += (uint64_t)hist[s] * k;
+    }
+    return bypass + model_bits(counts, 9, ESTIMATE_CLASS_TOTAL);
+}
+
+// PP_ENTROPY_BITTREE adapts within a few dozen decisions per node, faster
+// than a histogram over a band can follow, so its cost is simulated: the
+// sampled symbols run through a probability tree carried from band to
+// band, priced by cost[p] = -log2(p / 2^BITTREE_PROB_BITS) in 1/65536
+// bits (integer sums keep the loop off the floating-point adder)
+static double bittree_bits(uint16_t probs[256], const uint32_t* cost, const uint8_t* sym, size_t len) {
+    const unsigned one = 1u << BITTREE_PROB_BITS;
+    uint64_t bits = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned node = 1;
+        for (int k = 7; k >= 0; k--) {
+            unsigned bit = sym[i] >> k & 1, p = probs[node];
+            bits += cost[bit ? one - p : p];
+            probs[node] = (uint16_t)(bit ? p - (p >> BITTREE_ADAPT_SHIFT) : p + ((one - p) >> BITTREE_ADAPT_SHIFT));
+            node = node << 1 | bit;
+        }
+    }
+    return bits / 65536.0;
+}
+
+uint64_t pp_estimate(const image_view* img, int strip_rows, const pp_options* opts, int sample_every) {
+    int width = img->width, height = img->height;
+    if (strip_rows <= 0 || strip_rows > height) strip_rows = height;
+    if (sample_every < 1) sample_every = 1;
+    pp_options o = opts ? *opts : pp_preset(PP_EFFORT_DEFAULT);
+    int skip = (o.flags & PP_FLAG_SKIP_BLOCKS) != 0;
+
+    // Per channel: the row above a band, then the band; then its residuals,
+    // their skip map and coded blocks, and room to RLE them. With the
+    // skip map, bands are whole rows of blocks.
+    int band = band_rows(width);
+    if (skip) band = (band + SKIP_BLOCK - 1) / SKIP_BLOCK * SKIP_BLOCK;
+    if (band > height) band = height;
+    size_t band_px = (size_t)band * width;
+    size_t sym_cap = band_px + skip_map_bytes(width, band);
+    uint8_t* mem = malloc(3 * (band_px + width) + band_px + 3 * sym_cap);
+    if (!mem) return 0;
+    uint8_t* res = mem + 3 * (band_px + width);
+    uint8_t* gathered = res + band_px;
+
+    // Channel-major like the coded stream; four histograms per channel
+    // break the store-to-load chain on long stretches of one symbol
+    uint32_t hist[3][4][256];
+    memset(hist, 0, sizeof(hist));
+    uint64_t symbols = 0, sampled_rows = 0;
+    double local_bits = 0;
+    int classes = o.entropy == PP_ENTROPY_CLASSES, tree = o.entropy == PP_ENTROPY_BITTREE;
+    uint16_t probs[256];
+    uint32_t cost[(1 << BITTREE_PROB_BITS) + 1];
+    if (tree) {
+        for (int i = 0; i < 256; i++) probs[i] = 1 << (BITTREE_PROB_BITS - 1);
+        for (int p = 1; p <= 1 << BITTREE_PROB_BITS; p++) cost[p] = (uint32_t)((BITTREE_PROB_BITS - log2(p)) * 65536 + 0.5);
+    }
+    int ri = img->bgr ? 2 : 0, bi = img->bgr ? 0 : 2;
+    // Bands sit at a pseudo-random offset in each step of sample_every
+    // bands, so periodic content cannot alias with the sampling
+    int step = band * sample_every;
+    uint32_t seed = 0x9E3779B9u;
+    for (int b0 = 0; b0 < height; b0 += step) {
+        seed = seed * 1664525u + 1013904223u;
+        int span = (height - b0 < step ? height - b0 : step) - band;
+        int y0 = b0 + (span > 0 ? (int)((seed >> 8) % (uint32_t)(span + 1)) : 0);
+        if (skip) y0 -= y0 % SKIP_BLOCK;
+        int rows = height - y0 < band ? height - y0 : band;
+        int first = y0 > 0 ? y0 - 1 : y0;
+        for (int r = first; r < y0 + rows; r++) {
+            const unsigned char* row = img->row0 + (ptrdiff_t)r * img->stride;
+            size_t off = (size_t)(r - y0 + 1) * width;      // row y0 - 1 lands at 0
+            uint8_t* p[3] = { mem + off, mem + band_px + width + off, mem + 2 * (band_px + width) + off };
+            for (int x = 0; x < width; x++) {
+                p[0][x] = row[3*x + ri];
+                p[1][x] = row[3*x + 1];
+                p[2][x] = row[3*x + bi];
+            }
+        }
+
+        for (int c = 0; c < 3; c++) {
+            uint8_t* plane = mem + c * (band_px + width);
+            for (int y = 0; y < rows; y++) {
+                const uint8_t* cur = plane + (size_t)(y + 1) * width;
+                residual_row(o.predictor, cur, y0 + y > 0 ? cur - width : NULL, width, res + (size_t)y * width);
+            }
+
+            const uint8_t* sym = res;
+            size_t n = (size_t)rows * width;
+            if (skip) {
+                n = skip_gather(res, width, rows, gathered);
+                sym = gathered;
+            }
+            if (o.rle != PP_RLE_NONE) {
+                uint8_t* packed = gathered + sym_cap;
+                n = o.rle == PP_RLE_PAIRS ? rle_encode_into(sym, n, packed) : packbits_encode_into(sym, n, packed);
+                sym = packed;
+            }
+            if (classes) {
+                local_bits += class_bits(sym, n);
+            } else if (tree) {
+                local_bits += bittree_bits(probs, cost, sym, n);
+            } else {
+                size_t i = 0;
+                for (; i + 4 <= n; i += 4) {
+                    hist[c][0][sym[i]]++;
+                    hist[c][1][sym[i + 1]]++;
+                    hist[c][2][sym[i + 2]]++;
+                    hist[c][3][sym[i + 3]]++;
+                }
+                for (; i < n; i++) hist[c][0][sym[i]]++;
+            }
+            symbols += n;
+        }
+        sampled_rows += rows;
+    }
+    free(mem);
+
+    uint64_t counts[3][256], pooled[256];
+    for (int s = 0; s < 256; s++) {
+        pooled[s] = 0;
+        for (int c = 0; c < 3; c++) {
+            counts[c][s] = (uint64_t)hist[c][0][s] + hist[c][1][s] + hist[c][2][s] + hist[c][3][s];
+            pooled[s] += counts[c][s];
+        }
+    }
+    double split = 0;
+    for (int c = 0; c < 3; c++) split += model_bits(counts[c], 256, ESTIMATE_MODEL_TOTAL);
+    double bits = ESTIMATE_CHANNEL_WEIGHT * split + (1 - ESTIMATE_CHANNEL_WEIGHT) * model_bits(pooled, 256, ESTIMATE_MODEL_TOTAL);
+    if (classes || tree) bits = local_bits;
+    double scale = (double)height / sampled_rows;
+    double raw = 3.0 * width * height;
+    int coder = o.entropy != PP_ENTROPY_NONE;
+    double payload = (coder ? bits / 8 : symbols) * scale;
+    if (coder && below_min_gain((size_t)payload, (size_t)raw)) payload = raw;
+    if (payload > raw) payload = raw;
+
+    int strips = (height + strip_rows - 1) / strip_rows;
+    uint64_t header = 4 + 4 * sizeof(int) + (is_legacy(&o) ? 0 : sizeof(pp_options));
+    return header + (uint64_t)strips * 2 * sizeof(uint64_t) + (uint64_t)(payload + 0.5);
+}
+
+int pp_read_header(FILE* f, pp_header* hdr) {
+    char magic[4];
+    if (fread(magic, 1, 4, f) != 4) return -1;
+
+    hdr->opts = legacy_options;
+    int with_options = memcmp(magic, PP_MAGIC_OPTIONS, 4) == 0;
+    if (with_options || memcmp(magic, PP_MAGIC, 4) == 0) {
+        if (fread(&hdr->width, sizeof(int), 1, f) != 1 ||
+            fread(&hdr->height, sizeof(int), 1, f) != 1 ||
+            fread(&hdr->channels, sizeof(int), 1, f) != 1 ||
+            fread(&hdr->strip_rows, sizeof(int), 1, f) != 1) return -1;
+        if (with_options && (fread(&hdr->opts, sizeof(pp_options), 1, f) != 1 || !valid_options(&hdr->opts))) return -1;
+    } else {
+        // Original layout: width, height, channels, total_len, rle_len,
+        // arith_len, data. Past total_len it is a single strip record.
+        uint64_t total_len;
+        memcpy(&hdr->width, magic, sizeof(int));
+        if (fread(&hdr->height, sizeof(int), 1, f) != 1 ||
+            fread(&hdr->channels, sizeof(int), 1, f) != 1 ||
+            fread(&total_len, sizeof(uint64_t), 1, f) != 1) return -1;
+        hdr->strip_rows = hdr->height;
+    }
+
+    if (hdr->width <= 0 || hdr->height <= 0 || hdr->channels != 3) return -1;
+    if (hdr->strip_rows <= 0 || hdr->strip_rows > hdr->height) return -1;
+    return 0;
+}
+
+int pp_decode(pp_context* ctx, FILE* f, const pp_header* hdr, image_view* out) {
+    int width = hdr->width, height = hdr->height, strip_rows = hdr->strip_rows;
+    const pp_options* o = &hdr->opts;
+
+    pp_context* own = NULL;
+    if (!ctx) ctx = own = pp_context_create(0);
+    if (!ctx || layout(ctx, width, strip_rows) != 0) {
+        pp_context_free(own);
+        return -1;
+    }
+    ctx->image_id = __atomic_fetch_add(&next_image_id, 1, __ATOMIC_RELAXED);
+    ctx->ac.image_id = ctx->bt.image_id = ctx->image_id;
+    PP_PROBE4(image_start, ctx->image_id, 1, width, height);
+
+    size_t strip_px = (size_t)width * strip_rows;
+    size_t plane_len = strip_px + width;
+    uint8_t* planes = ctx->planes;
+    uint8_t* residuals = ctx->residuals;
+
+    int ri = out->bgr ? 2 : 0, bi = out->bgr ? 0 : 2;
+    int ok = 1;
+    uint64_t coded_total = 0;      // strip records read
+    for (int y0 = 0; y0 < height && ok; y0 += strip_rows) {
+        int rows = height - y0 < strip_rows ? height - y0 : strip_rows;
+        size_t px = (size_t)width * rows;
+
+        uint64_t lens[2];
+        if (fread(lens, sizeof(uint64_t), 2, f) != 2) {
+            ok = 0;
+            break;
+        }
+        // The encoder never exceeds these bounds; anything larger is corrupt.
+        // Skipped stages read straight into the next stage's input.
+        // Stored strips go straight to the residuals.
+        int stored = (lens[0] & STRIP_STORED) != 0;
+        int skip = (o->flags & PP_FLAG_SKIP_BLOCKS) && !stored;
+        int rle_coded = o->rle != PP_RLE_NONE && !stored;
+        int entropy = o->entropy != PP_ENTROPY_NONE && !stored;
+        size_t d_rle = lens[0] & ~STRIP_STORED, d_arith = lens[1];
+        unsigned char* sym = skip ? ctx->skip : residuals;
+        size_t sym_cap = skip ? ctx->skip_cap : 3 * px;
+        size_t sym_len = d_rle;
+        unsigned char* rle = rle_coded ? ctx->rle : sym;
+        unsigned char* coded = entropy ? ctx->coded : rle;
+        size_t rle_cap = rle_coded ? ctx->rle_cap : sym_cap;
+        if (d_rle > rle_cap || d_arith > ctx->coded_cap ||
+            (!entropy && d_arith != d_rle) ||
+            (!rle_coded && !skip && d_rle != 3 * px) ||
+            fread(coded, 1, d_arith, f) != d_arith) {
+            ok = 0;
+            break;
+        }
+        coded_total += sizeof(lens) + d_arith;
+
+        // Arithmetic decode
+        if (entropy) {
+            stage_begin(ctx, PP_STAGE_ENTROPY_DEC, y0, d_arith, d_rle);
+            if (o->entropy == PP_ENTROPY_CLASSES) arith_decode_classes(&ctx->ac, coded, d_arith, rle, d_rle);
+            else if (o->entropy == PP_ENTROPY_BITTREE) bittree_decode(&ctx->bt, coded, d_arith, rle, d_rle);
+            else arith_decode(&ctx->ac, coded, d_arith, rle, d_rle);
+            stage_end(ctx, PP_STAGE_ENTROPY_DEC, d_arith, d_rle);
+            count_coder_events(ctx, PP_STAGE_ENTROPY_DEC, o->entropy);
+        }
+
+        // RLE decode. Without the skip map the output is exactly 3 * px.
+        if (rle_coded) {
+            stage_begin(ctx, PP_STAGE_RLE_DEC, y0, d_rle, skip ? 0 : 3 * px);
+            if (o->rle == PP_RLE_PACKBITS) {
+                sym_len = packbits_decode_into(rle, d_rle, sym, sym_cap);
+            } else if (skip) {
+                sym_len = 0;
+                for (size_t i = 0; i + 1 < d_rle; i += 2) sym_len += rle[i];
+                if (sym_len <= sym_cap) rle_decode_into(rle, d_rle, sym, sym_len);
+            } else {
+                sym_len = 3 * px;
+                rle_decode_into(rle, d_rle, sym, sym_len);
+            }
+            stage_end(ctx, PP_STAGE_RLE_DEC, d_rle, sym_len);
+            if (sym_len == 0 || sym_len > sym_cap || (!skip && sym_len != 3 * px)) {
+                ok = 0;
+                break;
+            }
+        }
+
+        // Inverse prediction, after spreading coded blocks over the planes
+        stage_begin(ctx, PP_STAGE_UNPREDICT, y0, 3 * px, 3 * px);
+        size_t pos = 0;
+        for (int c = 0; c < 3 && ok; c++) {
+            uint8_t* p = plane_row0(planes, c, plane_len);
+            if (y0 > 0) memcpy(p, p + strip_px, width);
+            if (!skip) {
+                unpredict(o->predictor, residuals + c * px, y0 > 0 ? p : NULL, p + width, width, rows);
+                continue;
+            }
+            const uint8_t* map = sym + pos;
+            size_t n = skip_scatter(map, sym_len - pos, width, rows, residuals + c * px);
+            if (n == 0) ok = 0;
+            else unpredict_skip(o->predictor, residuals + c * px, y0 > 0 ? p : NULL, p + width, width, rows, map);
+            pos += n;
+        }
+        if (skip && pos != sym_len) ok = 0;
+        stage_end(ctx, PP_STAGE_UNPREDICT, 3 * px, 3 * px);
+        if (!ok) break;
+
+        // Interleave straight into the output image
+        stage_begin(ctx, PP_STAGE_INTERLEAVE, y0, 3 * px, 3 * px);
+        const uint8_t* img_r = plane_row0(planes, 0, plane_len) + width;
+        const uint8_t* img_g = plane_row0(planes, 1, plane_len) + width;
+        const uint8_t* img_b = plane_row0(planes, 2, plane_len) + width;
+        for (int y = 0; y < rows; y++) {
+            unsigned char* row = out->row0 + (ptrdiff_t)(y0 + y) * out->stride;
+            size_t base = (size_t)y * width;
+            for (int x = 0; x < width; x++) {
+                row[3*x + ri] = img_r[base + x];
+                row[3*x + 1] = img_g[base + x];
+                row[3*x + bi] = img_b[base + x];
+            }
+        }
+        image_release_rows(out, y0, y0 + rows);
+        stage_end(ctx, PP_STAGE_INTERLEAVE, 3 * px, 3 * px);
+    }
+
+    PP_PROBE4(image_end, ctx->image_id, 1, ok, coded_total);
+    pp_context_free(own);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,168 @@
+// codec.h -- LOCO-I prediction, RLE and arithmetic coding of RGB images
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "imgio.h"
+
+#define PP_MAGIC "PPC1"
+#define PP_MAGIC_OPTIONS "PPC2"    // PP_MAGIC header followed by pp_options
+
+typedef enum {
+    PP_PRED_NONE,       // pixels coded as they are
+    PP_PRED_LEFT,       // a (above for the first column)
+    PP_PRED_MED,        // LOCO-I median edge detector
+    PP_PRED_COUNT
+} pp_predictor;
+
+typedef enum {
+    PP_RLE_NONE,
+    PP_RLE_PAIRS,       // (run, value) byte pairs
+    PP_RLE_PACKBITS,    // literal spans and varint-length runs
+    PP_RLE_COUNT
+} pp_rle_mode;
+
+typedef enum {
+    PP_ENTROPY_NONE,    // stored
+    PP_ENTROPY_ARITH,   // adaptive order-0 arithmetic coder
+    PP_ENTROPY_CLASSES, // adaptive magnitude classes, bypass-coded low bits
+    PP_ENTROPY_BITTREE, // binary range coder, 8 decisions per byte
+    PP_ENTROPY_COUNT
+} pp_entropy;
+
+// Pipeline choices, one byte each on disk. The original pipeline (MED,
+// pairs, arith) is written with the PP_MAGIC header that older decoders
+// read; anything else needs a decoder that knows PP_MAGIC_OPTIONS.
+typedef struct {
+    uint8_t predictor;
+    uint8_t rle;
+    uint8_t entropy;
+    uint8_t flags;      // PP_FLAG_*
+} pp_options;
+
+// Each channel plane of a strip is cut into 16 x 16 blocks, and a bitmap
+// of the blocks holding any nonzero residual goes ahead of those blocks'
+// residuals; all-zero blocks bypass RLE and entropy coding entirely and
+// are rebuilt from the prediction alone.
+#define PP_FLAG_SKIP_BLOCKS 0x01
+
+#define PP_EFFORT_MIN 1
+#define PP_EFFORT_MAX 4
+#define PP_EFFORT_DEFAULT 4
+
+extern const char* const pp_predictor_names[PP_PRED_COUNT];
+extern const char* const pp_rle_names[PP_RLE_COUNT];
+extern const char* const pp_entropy_names[PP_ENTROPY_COUNT];
+
+// Effort 1 (fastest) .. PP_EFFORT_MAX (densest); out of range values are clamped.
+pp_options pp_preset(int effort);
+
+typedef struct {
+    int width, height;
+    int channels;
+    int strip_rows;     // rows per independently coded strip
+    pp_options opts;
+} pp_header;
+
+int loco_predict(int a, int b, int c);
+
+// `above` is the row preceding src, or NULL at the top of the image
+void compute_residuals(const uint8_t* src, const uint8_t* above, int width, int height, uint8_t* residuals);
+void inverse_predict_loco_i(const uint8_t* resid, const uint8_t* above, uint8_t* out, int wid, int ht);
+
+// out must hold 2 * len bytes (one run/value pair per input byte)
+size_t rle_encode_into(const unsigned char* data, size_t len, unsigned char* out);
+void rle_decode_into(const unsigned char* data, size_t len, unsigned char* out, size_t out_len);
+
+// PackBits with unbounded runs. Control byte h < 0x80: h + 1 literal
+// bytes follow. 0x80 <= h < 0xFF: a run of h - 0x80 + 2 copies of the next
+// byte. 0xFF: a LEB128 varint v, then the byte, repeated v + 129 times.
+// Runs start at 3 bytes, so incompressible data grows by 1/128 at most:
+// out must hold len + len / 128 + 1 bytes.
+size_t packbits_encode_into(const unsigned char* data, size_t len, unsigned char* out);
+
+// Returns the bytes written, or 0 if data is malformed or would overrun out
+size_t packbits_decode_into(const unsigned char* data, size_t len, unsigned char* out, size_t out_len);
+
+unsigned char* rle_encode(const unsigned char* data, size_t len, size_t* out_len);
+unsigned char* rle_decode(const unsigned char* data, size_t len, size_t out_len);
+
+typedef enum {
+    PP_STAGE_SPLIT,         // interleaved pixels -> channel planes
+    PP_STAGE_PREDICT,       // residuals, and the skip map if enabled
+    PP_STAGE_RLE,           // pair or PackBits run-length coding
+    PP_STAGE_ENTROPY,       // entropy coder of pp_options.entropy
+    PP_STAGE_ENTROPY_DEC,   // matching entropy decoder
+    PP_STAGE_RLE_DEC,       // run-length expansion
+    PP_STAGE_UNPREDICT,     // residuals + prediction -> pixels
+    PP_STAGE_INTERLEAVE,    // channel planes -> output pixels
+    PP_STAGE_COUNT
+} pp_stage;
+
+extern const char* const pp_stage_names[PP_STAGE_COUNT];
+
+typedef void (*pp_stage_hook)(void* arg, pp_stage stage, int end);
+
+// Per-stage totals, accumulated over every strip coded while attached to
+// a context with pp_set_stats(). Nothing is measured when detached. The
+// optional hook runs just outside the timed region on entry to (end = 0)
+// and exit from (end = 1) every stage, e.g. to read hardware counters.
+typedef struct {
+    double seconds[PP_STAGE_COUNT];
+    uint64_t bytes_in[PP_STAGE_COUNT];
+    uint64_t bytes_out[PP_STAGE_COUNT];
+
+    // Arithmetic coder events, entropy stages only
+    uint64_t rescales[PP_STAGE_COUNT];      // model frequency halvings
+    uint64_t underflows[PP_STAGE_COUNT];    // straddling-interval (E3) expansions
+    size_t arena_bytes;                     // largest stage buffer mapping
+    uint64_t strips;                        // strips encoded
+    uint64_t stored_strips;                 // of which stored uncoded
+
+    // Diagnostic: if set, pp_encode adds the coded bits each pixel cost
+    // (all three channels) to bit_map[y * width + x]. Symbols that stand
+    // for several pixels, like RLE pairs, are shared evenly among them.
+    float* bit_map;
+
+    pp_stage_hook hook;
+    void* hook_arg;
+} pp_stats;
+
+// Reusable stage buffers (one arena) and coder state. One per thread; the
+// arena only grows, so a context that has coded its largest image does no
+// further allocation. huge_pages backs the arena with transparent huge
+// pages, which cuts TLB misses on large strips.
+typedef struct pp_context pp_context;
+
+pp_context* pp_context_create(int huge_pages);
+void pp_context_free(pp_context* ctx);
+void pp_set_stats(pp_context* ctx, pp_stats* stats);
+
+// Encodes img to f in horizontal strips of strip_rows rows (0 = one strip
+// for the whole image). Only the current strip and one context row per
+// channel are resident, so memory use does not grow with image height.
+// ctx may be NULL for a one-off call, opts NULL for the default pipeline.
+// Returns 0 on success, -1 on failure.
+int pp_encode(pp_context* ctx, const image_view* img, int strip_rows, const pp_options* opts,
+              FILE* f, uint64_t* compressed_bytes);
+
+// Predicts pp_encode()'s output size without coding. Residuals of one
+// band of rows in every sample_every (1 = every row) feed an order-0
+// model of the symbols the entropy stage would see, calibrated against
+// the adaptive coder (per band for the faster-adapting class coder; the
+// bit-tree coder's probabilities are simulated, which costs more). Within
+// a few percent on photographic content, at around a hundredth of the
+// encode cost; outputs of a fraction of a percent of the raw size are only
+// right in order of magnitude.
+uint64_t pp_estimate(const image_view* img, int strip_rows, const pp_options* opts, int sample_every);
+
+// Reads the header of a .pp file, including files from before PP_MAGIC
+// existed. Leaves f positioned for pp_decode().
+int pp_read_header(FILE* f, pp_header* hdr);
+
+// Decodes the strips that follow the header into out, one strip at a time.
+int pp_decode(pp_context* ctx, FILE* f, const pp_header* hdr, image_view* out);
+
+#endif // CODEC_H
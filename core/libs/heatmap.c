@@ -0,0 +1,59 @@
+// heatmap.c -- PNG rendering of per-pixel coding cost
+#include "heatmap.h"
+#include <stdlib.h>
+#include "stb_image_write.h"
+
+// Colour stops evenly spaced over [0, HEATMAP_MAX_BITS]
+static const unsigned char ramp[][3] = {
+    {   0,   0,   0 },
+    {  40,  40, 200 },
+    { 220,  40,  40 },
+    { 250, 210,  40 },
+    { 255, 255, 255 },
+};
+#define N_STOPS (sizeof(ramp) / sizeof(ramp[0]))
+
+static void colour(double bits, unsigned char* rgb) {
+    double t = bits / HEATMAP_MAX_BITS * (N_STOPS - 1);
+    if (t < 0) t = 0;
+    if (t > N_STOPS - 1) t = N_STOPS - 1;
+    int i = (int)t < (int)N_STOPS - 1 ? (int)t : (int)N_STOPS - 2;
+    double f = t - i;
+    for (int c = 0; c < 3; c++) rgb[c] = (unsigned char)(ramp[i][c] + f * (ramp[i + 1][c] - ramp[i][c]) + 0.5);
+}
+
+int heatmap_write_png(const char* path, const float* bits, int width, int height, int block, double* max_bits) {
+    if (block < 1) block = 1;
+    unsigned char* rgb = malloc((size_t)width * height * 3);
+    if (!rgb) return -1;
+
+    double hottest = 0;
+    for (int by = 0; by < height; by += block) {
+        int y1 = by + block < height ? by + block : height;
+        for (int bx = 0; bx < width; bx += block) {
+            int x1 = bx + block < width ? bx + block : width;
+            double sum = 0;
+            for (int y = by; y < y1; y++) {
+                for (int x = bx; x < x1; x++) sum += bits[(size_t)y * width + x];
+            }
+            double mean = sum / ((double)(y1 - by) * (x1 - bx));
+            if (mean > hottest) hottest = mean;
+
+            unsigned char c[3];
+            colour(mean, c);
+            for (int y = by; y < y1; y++) {
+                for (int x = bx; x < x1; x++) {
+                    unsigned char* p = rgb + ((size_t)y * width + x) * 3;
+                    p[0] = c[0];
+                    p[1] = c[1];
+                    p[2] = c[2];
+                }
+            }
+        }
+    }
+
+    int ok = stbi_write_png(path, width, height, 3, rgb, width * 3);
+    free(rgb);
+    if (max_bits) *max_bits = hottest;
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,16 @@
+// heatmap.h -- PNG rendering of per-pixel coding cost
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+// Upper end of the colour scale: raw 8-bit RGB
+#define HEATMAP_MAX_BITS 24.0
+
+// Averages bits (width * height values, e.g. pp_stats.bit_map) over
+// block x block tiles and writes them as a PNG of the image's size, from
+// black (0 bits/pixel) through blue, red and yellow to white at
+// HEATMAP_MAX_BITS and above. Fixed scale, so maps of different images
+// compare directly. Stores the hottest tile's mean in *max_bits if set.
+// Returns 0 or -1.
+int heatmap_write_png(const char* path, const float* bits, int width, int height, int block, double* max_bits);
+
+#endif // HEATMAP_H
@@ -0,0 +1,241 @@
+// imgio.c -- native BMP/PPM pixel access with stb_image fallback
+#include "imgio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The stb implementations live here for every program linking libs/
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#define BMP_HEADER_SIZE 54
+
+static const char* failure_reason = "";
+
+const char* image_failure_reason(void) {
+    return failure_reason;
+}
+
+static uint32_t read_le32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write_le32(unsigned char* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static int has_suffix(const char* s, const char* suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+// Accept only 24-bit BI_RGB files; everything else falls back to stb
+static int map_bmp(unsigned char* data, size_t len, image_view* img) {
+    if (len < BMP_HEADER_SIZE || data[0] != 'B' || data[1] != 'M') return 0;
+
+    uint32_t offset = read_le32(data + 10);
+    uint32_t dib_size = read_le32(data + 14);
+    int32_t width = (int32_t)read_le32(data + 18);
+    int32_t height = (int32_t)read_le32(data + 22);
+    int bpp = data[28] | (data[29] << 8);
+    uint32_t compression = read_le32(data + 30);
+    if (dib_size < 40 || bpp != 24 || compression != 0) return 0;
+    if (width <= 0 || height == 0 || height == INT32_MIN) return 0;
+
+    int top_down = height < 0;
+    if (top_down) height = -height;
+    size_t row_size = ((size_t)width * 3 + 3) & ~(size_t)3;
+    if (offset > len || (len - offset) / row_size < (size_t)height) return 0;
+
+    img->width = width;
+    img->height = height;
+    img->bgr = 1;
+    if (top_down) {
+        img->row0 = data + offset;
+        img->stride = (ptrdiff_t)row_size;
+    } else {
+        img->row0 = data + offset + (size_t)(height - 1) * row_size;
+        img->stride = -(ptrdiff_t)row_size;
+    }
+    return 1;
+}
+
+// Reads the next PPM header token, skipping whitespace and comments
+static long ppm_token(const unsigned char* data, size_t len, size_t* pos) {
+    while (*pos < len) {
+        if (data[*pos] == '#') {
+            while (*pos < len && data[*pos] != '\n') (*pos)++;
+        } else if (data[*pos] == ' ' || data[*pos] == '\t' || data[*pos] == '\r' || data[*pos] == '\n') {
+            (*pos)++;
+        } else {
+            break;
+        }
+    }
+    long v = -1;
+    while (*pos < len && data[*pos] >= '0' && data[*pos] <= '9') {
+        v = (v < 0 ? 0 : v * 10) + (data[*pos] - '0');
+        if (v > INT32_MAX) return -1;
+        (*pos)++;
+    }
+    return v;
+}
+
+static int map_ppm(unsigned char* data, size_t len, image_view* img) {
+    if (len < 2 || data[0] != 'P' || data[1] != '6') return 0;
+
+    size_t pos = 2;
+    long width = ppm_token(data, len, &pos);
+    long height = ppm_token(data, len, &pos);
+    long maxval = ppm_token(data, len, &pos);
+    if (width <= 0 || height <= 0 || maxval != 255 || pos >= len) return 0;
+    pos++;  // single whitespace before the raster
+
+    size_t row_size = (size_t)width * 3;
+    if ((len - pos) / row_size < (size_t)height) return 0;
+
+    img->width = (int)width;
+    img->height = (int)height;
+    img->bgr = 0;
+    img->row0 = data + pos;
+    img->stride = (ptrdiff_t)row_size;
+    return 1;
+}
+
+int image_open(const char* path, image_view* img) {
+    memset(img, 0, sizeof(*img));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        failure_reason = "can't open file";
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        size_t len = (size_t)st.st_size;
+        unsigned char* data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            if (map_bmp(data, len, img) || map_ppm(data, len, img)) {
+                madvise(data, len, MADV_SEQUENTIAL);
+                close(fd);
+                img->map = data;
+                img->map_len = len;
+                return 0;
+            }
+            munmap(data, len);
+        }
+    }
+    close(fd);
+
+    // Not a format we read natively
+    int channels;
+    img->owned = stbi_load(path, &img->width, &img->height, &channels, 3);
+    if (!img->owned) {
+        failure_reason = stbi_failure_reason();
+        return -1;
+    }
+    img->row0 = img->owned;
+    img->stride = (ptrdiff_t)img->width * 3;
+    img->bgr = 0;
+    return 0;
+}
+
+int image_create(const char* path, int width, int height, image_view* img) {
+    memset(img, 0, sizeof(*img));
+
+    int ppm = has_suffix(path, ".ppm");
+    char ppm_header[64];
+    size_t header_len, row_size;
+    if (ppm) {
+        header_len = (size_t)snprintf(ppm_header, sizeof(ppm_header), "P6\n%d %d\n255\n", width, height);
+        row_size = (size_t)width * 3;
+    } else {
+        header_len = BMP_HEADER_SIZE;
+        row_size = ((size_t)width * 3 + 3) & ~(size_t)3;
+    }
+    size_t len = header_len + row_size * height;
+    if (!ppm && len > UINT32_MAX) {
+        failure_reason = "image too large for BMP";
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        failure_reason = "can't create file";
+        return -1;
+    }
+    // Reserve the blocks now: writing sparse pages of a shared mapping on a
+    // full disk raises SIGBUS instead of returning an error
+    if (posix_fallocate(fd, 0, (off_t)len) != 0) {
+        close(fd);
+        unlink(path);
+        failure_reason = "can't allocate output file (disk full?)";
+        return -1;
+    }
+    unsigned char* data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        failure_reason = "can't map output file";
+        return -1;
+    }
+
+    img->map = data;
+    img->map_len = len;
+    img->width = width;
+    img->height = height;
+    if (ppm) {
+        memcpy(data, ppm_header, header_len);
+        img->bgr = 0;
+        img->row0 = data + header_len;
+        img->stride = (ptrdiff_t)row_size;
+        return 0;
+    }
+
+    // BITMAPFILEHEADER + BITMAPINFOHEADER, rows stored bottom-up.
+    // posix_fallocate already zeroed the reserved fields and row padding.
+    data[0] = 'B';
+    data[1] = 'M';
+    write_le32(data + 2, (uint32_t)len);
+    write_le32(data + 10, BMP_HEADER_SIZE);
+    write_le32(data + 14, 40);
+    write_le32(data + 18, (uint32_t)width);
+    write_le32(data + 22, (uint32_t)height);
+    data[26] = 1;
+    data[28] = 24;
+    write_le32(data + 34, (uint32_t)(row_size * height));
+    img->bgr = 1;
+    img->row0 = data + BMP_HEADER_SIZE + (size_t)(height - 1) * row_size;
+    img->stride = -(ptrdiff_t)row_size;
+    return 0;
+}
+
+void image_release_rows(const image_view* img, int y0, int y1) {
+    if (!img->map || y0 >= y1) return;
+
+    unsigned char* first = img->row0 + (ptrdiff_t)y0 * img->stride;
+    unsigned char* last = img->row0 + (ptrdiff_t)(y1 - 1) * img->stride;
+    unsigned char* lo = first < last ? first : last;
+    unsigned char* hi = (first < last ? last : first) + (size_t)img->width * 3;
+
+    // Only whole pages strictly inside the rows
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)lo + page - 1) & ~(page - 1);
+    uintptr_t end = (uintptr_t)hi & ~(page - 1);
+    if (start < end) madvise((void*)start, end - start, MADV_DONTNEED);
+}
+
+void image_close(image_view* img) {
+    if (img->map) munmap(img->map, img->map_len);
+    if (img->owned) stbi_image_free(img->owned);
+    memset(img, 0, sizeof(*img));
+}
@@ -0,0 +1,40 @@
+// imgio.h -- native BMP/PPM pixel access with stb_image fallback
+#ifndef IMGIO_H
+#define IMGIO_H
+
+#include <stddef.h>
+
+// A view of 8-bit, 3-channel pixels. Row y starts at row0 + y * stride;
+// stride is negative for bottom-up BMP files so no flip is ever needed.
+typedef struct {
+    unsigned char* row0;    // top row of the image
+    ptrdiff_t stride;       // bytes between consecutive rows
+    int width, height;
+    int bgr;                // 1 if pixels are stored B,G,R (BMP), 0 for R,G,B
+
+    void* map;              // mmap'ed file, if any
+    size_t map_len;
+    unsigned char* owned;   // stb_image buffer, if any
+} image_view;
+
+// Opens an image for reading. 24-bit uncompressed BMP and binary PPM (P6)
+// are mapped straight from the file; anything else goes through stb_image.
+// Returns 0 on success, -1 on failure (see image_failure_reason()).
+int image_open(const char* path, image_view* img);
+
+// Creates a writable image file of the given size and maps it, so the
+// decoder can store rows directly into the file. Writes binary PPM when
+// the path ends in ".ppm", 24-bit BMP otherwise. Returns 0 or -1.
+int image_create(const char* path, int width, int height, image_view* img);
+
+// Tells the kernel rows [y0, y1) won't be touched again, so streaming
+// callers keep a bounded resident set on mapped files. No-op otherwise.
+void image_release_rows(const image_view* img, int y0, int y1);
+
+// Unmaps or frees the pixels. For images from image_create this is what
+// commits the data to disk.
+void image_close(image_view* img);
+
+const char* image_failure_reason(void);
+
+#endif // IMGIO_H
@@ -0,0 +1,92 @@
+// perfctr.c -- per-thread hardware counters via perf_event_open
+#include "perfctr.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+const char* const perf_counter_names[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses",
+};
+
+static __thread const char* failure_reason = "";
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERF_COUNTER_COUNT] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+static int open_event(perf_counter c, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[c].type;
+    attr.config = events[c].config;
+    attr.disabled = group < 0;      // the leader starts the whole group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+int perf_open(perf_counters* pc) {
+    pc->leader = -1;
+    pc->opened = 0;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        pc->fd[c] = open_event((perf_counter)c, pc->leader);
+        pc->slot[c] = -1;
+        if (pc->fd[c] < 0) {
+            if (pc->leader < 0) failure_reason = strerror(errno);
+            continue;
+        }
+        if (pc->leader < 0) pc->leader = pc->fd[c];
+        pc->slot[c] = pc->opened++;
+    }
+    if (pc->leader < 0) return 0;
+
+    ioctl(pc->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return pc->opened;
+}
+
+int perf_read(const perf_counters* pc, uint64_t values[PERF_COUNTER_COUNT]) {
+    memset(values, 0, PERF_COUNTER_COUNT * sizeof(uint64_t));
+    if (pc->leader < 0) return -1;
+
+    // { nr, time_enabled, time_running, value[nr] }
+    uint64_t buf[3 + PERF_COUNTER_COUNT];
+    ssize_t n = read(pc->leader, buf, sizeof(buf));
+    if (n < (ssize_t)(3 * sizeof(uint64_t)) || buf[0] != (uint64_t)pc->opened) return -1;
+
+    double scale = buf[2] > 0 && buf[2] < buf[1] ? (double)buf[1] / buf[2] : 1.0;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (pc->slot[c] >= 0) values[c] = (uint64_t)(buf[3 + pc->slot[c]] * scale);
+    }
+    return 0;
+}
+
+int perf_available(const perf_counters* pc, perf_counter c) {
+    return pc->fd[c] >= 0;
+}
+
+void perf_close(perf_counters* pc) {
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+        if (pc->fd[c] >= 0) close(pc->fd[c]);
+        pc->fd[c] = -1;
+    }
+    pc->leader = -1;
+    pc->opened = 0;
+}
+
+const char* perf_failure_reason(void) {
+    return failure_reason;
+}
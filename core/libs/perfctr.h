@@ -0,0 +1,43 @@
+// perfctr.h -- per-thread hardware counters via perf_event_open
+//
+// Counters are opened as one group on the calling thread, user space only,
+// and read with a single syscall. Anything the kernel, PMU or container
+// refuses is simply marked unavailable, so callers run the same code
+// whether zero or all counters open.
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdint.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_COUNTER_COUNT
+} perf_counter;
+
+extern const char* const perf_counter_names[PERF_COUNTER_COUNT];
+
+typedef struct {
+    int fd[PERF_COUNTER_COUNT];     // -1 if unavailable
+    int slot[PERF_COUNTER_COUNT];   // position in the group read
+    int leader;                     // group leader fd, -1 if none opened
+    int opened;
+} perf_counters;
+
+// Opens every counter it can on the calling thread. Returns the number
+// opened (0 when perf is not permitted; see perf_failure_reason()).
+int perf_open(perf_counters* pc);
+
+// Current counts, scaled for multiplexing; unavailable counters read 0.
+// Returns 0 or -1.
+int perf_read(const perf_counters* pc, uint64_t values[PERF_COUNTER_COUNT]);
+
+int perf_available(const perf_counters* pc, perf_counter c);
+void perf_close(perf_counters* pc);
+
+const char* perf_failure_reason(void);
+
+#endif // PERFCTR_H
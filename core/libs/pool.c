@@ -0,0 +1,226 @@
+// pool.c -- work-stealing thread pool
+//
+// Every worker owns a deque. It pops its own work from the tail (newest
+// first) and, when empty, steals from the head of the others (oldest
+// first), so one long task never holds up the tasks queued behind it.
+#include "pool.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct {
+    pool_task_fn fn;
+    void* arg;
+} task;
+
+typedef struct {
+    pthread_mutex_t lock;
+    task* items;
+    size_t cap;
+    size_t head, tail;      // items[head % cap] .. items[(tail - 1) % cap]
+} deque;
+
+struct pool {
+    int nthreads;
+    pthread_t* threads;
+    deque* deques;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;     // a task was queued, or stopping
+    pthread_cond_t idle_cv;     // pending dropped to zero
+    size_t queued;              // tasks sitting in deques
+    size_t pending;             // tasks queued or running
+    unsigned next;              // round-robin target for outside submits
+    int stop;
+};
+
+typedef struct {
+    pool* p;
+    int index;
+} worker_arg;
+
+static __thread pool* current_pool;
+static __thread int current_worker;
+
+static int deque_push(deque* d, task t) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail - d->head == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 64;
+        task* items = malloc(cap * sizeof(task));
+        if (!items) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (size_t i = d->head; i < d->tail; i++) {
+            items[i - d->head] = d->items[i % d->cap];
+        }
+        free(d->items);
+        d->items = items;
+        d->tail -= d->head;
+        d->head = 0;
+        d->cap = cap;
+    }
+    d->items[d->tail++ % d->cap] = t;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+// Owner end: newest task first
+static int deque_pop(deque* d, task* t) {
+    pthread_mutex_lock(&d->lock);
+    int ok = d->tail != d->head;
+    if (ok) *t = d->items[--d->tail % d->cap];
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+// Thief end: oldest task first
+static int deque_steal(deque* d, task* t) {
+    pthread_mutex_lock(&d->lock);
+    int ok = d->tail != d->head;
+    if (ok) *t = d->items[d->head++ % d->cap];
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static int take_task(pool* p, int self, task* t) {
+    int found = deque_pop(&p->deques[self], t);
+    for (int i = 1; !found && i < p->nthreads; i++) {
+        found = deque_steal(&p->deques[(self + i) % p->nthreads], t);
+    }
+    if (found) {
+        pthread_mutex_lock(&p->lock);
+        p->queued--;
+        pthread_mutex_unlock(&p->lock);
+    }
+    return found;
+}
+
+static void* worker_main(void* argp) {
+    worker_arg* wa = argp;
+    pool* p = wa->p;
+    int self = wa->index;
+    free(wa);
+
+    current_pool = p;
+    current_worker = self;
+
+    for (;;) {
+        task t;
+        if (take_task(p, self, &t)) {
+            t.fn(t.arg, self);
+            pthread_mutex_lock(&p->lock);
+            if (--p->pending == 0) pthread_cond_broadcast(&p->idle_cv);
+            pthread_mutex_unlock(&p->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        while (p->queued == 0 && !p->stop) {
+            pthread_cond_wait(&p->work_cv, &p->lock);
+        }
+        int done = p->stop && p->queued == 0;
+        pthread_mutex_unlock(&p->lock);
+        if (done) break;
+    }
+    return NULL;
+}
+
+pool* pool_create(int nthreads) {
+    if (nthreads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = n > 0 ? (int)n : 1;
+    }
+
+    pool* p = calloc(1, sizeof(pool));
+    if (!p) return NULL;
+    p->threads = calloc(nthreads, sizeof(pthread_t));
+    p->deques = calloc(nthreads, sizeof(deque));
+    if (!p->threads || !p->deques) {
+        free(p->threads);
+        free(p->deques);
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work_cv, NULL);
+    pthread_cond_init(&p->idle_cv, NULL);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&p->deques[i].lock, NULL);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        worker_arg* wa = malloc(sizeof(worker_arg));
+        if (!wa) break;
+        wa->p = p;
+        wa->index = i;
+        if (pthread_create(&p->threads[i], NULL, worker_main, wa) != 0) {
+            free(wa);
+            break;
+        }
+        p->nthreads++;
+    }
+    if (p->nthreads == 0) {
+        pool_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+int pool_threads(const pool* p) {
+    return p->nthreads;
+}
+
+int pool_submit(pool* p, pool_task_fn fn, void* arg) {
+    task t = { fn, arg };
+    pthread_mutex_lock(&p->lock);
+    int target = current_pool == p ? current_worker : (int)(p->next++ % p->nthreads);
+    // Counted before the push, so a thief that takes the task straight
+    // away never decrements queued below zero
+    p->pending++;
+    p->queued++;
+    pthread_mutex_unlock(&p->lock);
+
+    if (deque_push(&p->deques[target], t) != 0) {
+        pthread_mutex_lock(&p->lock);
+        p->queued--;
+        if (--p->pending == 0) pthread_cond_broadcast(&p->idle_cv);
+        pthread_mutex_unlock(&p->lock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    pthread_cond_signal(&p->work_cv);
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+void pool_wait(pool* p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->pending > 0) {
+        pthread_cond_wait(&p->idle_cv, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void pool_destroy(pool* p) {
+    if (!p) return;
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->work_cv);
+    pthread_mutex_unlock(&p->lock);
+
+    for (int i = 0; i < p->nthreads; i++) {
+        pthread_join(p->threads[i], NULL);
+    }
+    for (int i = 0; i < p->nthreads; i++) {
+        free(p->deques[i].items);
+        pthread_mutex_destroy(&p->deques[i].lock);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work_cv);
+    pthread_cond_destroy(&p->idle_cv);
+    free(p->threads);
+    free(p->deques);
+    free(p);
+}
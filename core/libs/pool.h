@@ -0,0 +1,24 @@
+// pool.h -- work-stealing thread pool
+#ifndef POOL_H
+#define POOL_H
+
+// Tasks receive the index of the worker running them, so callers can keep
+// per-worker state (buffers, coder contexts) in a plain array.
+typedef void (*pool_task_fn)(void* arg, int worker);
+
+typedef struct pool pool;
+
+// Starts nthreads workers, or one per online CPU when nthreads <= 0.
+pool* pool_create(int nthreads);
+int pool_threads(const pool* p);
+
+// Queues a task. From inside a task it goes on the calling worker's own
+// deque; otherwise deques are filled round-robin. Returns 0 or -1.
+int pool_submit(pool* p, pool_task_fn fn, void* arg);
+
+// Blocks until every submitted task has finished.
+void pool_wait(pool* p);
+
+void pool_destroy(pool* p);
+
+#endif // POOL_H
@@ -0,0 +1,35 @@
+// probes.h -- optional USDT tracepoints
+//
+// Built with -DPP_USDT (needs <sys/sdt.h>, e.g. systemtap-sdt-dev), every
+// PP_PROBE site becomes a single nop plus an ELF note that bpftrace and
+// perf can attach to at run time:
+//
+//   bpftrace -e 'usdt:./algo:pied_piper:stage_end { @[arg1] = sum(arg3); }'
+//
+// Without PP_USDT the macros expand to nothing.
+//
+// Provider "pied_piper":
+//   image_start(image, op, width, height)     op 0 = encode, 1 = decode
+//   image_end(image, op, ok, bytes)           bytes written or read
+//   stage_start(image, stage, y0, bytes_in, bytes_out)
+//                                             stage is a pp_stage; bytes_out
+//                                             is 0 if only known at the end
+//   stage_end(image, stage, bytes_in, bytes_out)
+//   arith_start(image, op, bytes_in)          one call per strip, any coder
+//   arith_end(image, op, bytes_in, bytes_out, rescales)
+// image ids are process-wide and increase by one per pp_encode/pp_decode.
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef PP_USDT
+#include <sys/sdt.h>
+#define PP_PROBE3(name, a, b, c) DTRACE_PROBE3(pied_piper, name, a, b, c)
+#define PP_PROBE4(name, a, b, c, d) DTRACE_PROBE4(pied_piper, name, a, b, c, d)
+#define PP_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(pied_piper, name, a, b, c, d, e)
+#else
+#define PP_PROBE3(name, a, b, c) do {} while (0)
+#define PP_PROBE4(name, a, b, c, d) do {} while (0)
+#define PP_PROBE5(name, a, b, c, d, e) do {} while (0)
+#endif
+
+#endif // PROBES_H
@@ -0,0 +1,359 @@
+// serve.c -- resident encode/decode daemon on a Unix domain socket
+#define _GNU_SOURCE
+#include "serve.h"
+#include "codec.h"
+#include "imgio.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define POLL_MS 500
+
+static volatile sig_atomic_t stopping;
+
+typedef struct {
+    int fd;
+    int wake;                  // write end of the wake pipe
+    pp_context** contexts;     // one per worker
+} conn_task;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static int send_with_fd(int sock, const void* buf, size_t len, int fd) {
+    struct iovec iov = { (void*)buf, len };
+    struct msghdr msg = {0};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+// Receives one message and at most one fd (*fd = -1 if none came with it)
+static ssize_t recv_with_fd(int sock, void* buf, size_t len, int* fd) {
+    struct iovec iov = { buf, len };
+    struct msghdr msg = {0};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(4 * sizeof(int))];
+    } ctl;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    *fd = -1;
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0) return n;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int got;
+            memcpy(&got, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+            if (*fd < 0) *fd = got;
+            else close(got);
+        }
+    }
+    return n;
+}
+
+// Returns a memfd holding the .pp stream, or -1
+static int serve_encode(pp_context* ctx, int in_fd, int strip_rows, int effort, uint64_t* out_len) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", in_fd);
+    image_view img;
+    if (image_open(path, &img) != 0) return -1;
+
+    int out_fd = memfd_create("pp-encoded", MFD_CLOEXEC);
+    int dup_fd = out_fd >= 0 ? dup(out_fd) : -1;
+    FILE* f = dup_fd >= 0 ? fdopen(dup_fd, "wb") : NULL;
+    if (!f) {
+        if (dup_fd >= 0) close(dup_fd);
+        if (out_fd >= 0) close(out_fd);
+        image_close(&img);
+        return -1;
+    }
+    pp_options opts = pp_preset(effort ? effort : PP_EFFORT_DEFAULT);
+    int ret = pp_encode(ctx, &img, strip_rows, &opts, f, out_len);
+    image_close(&img);
+    if (fclose(f) != 0 || ret != 0) {
+        close(out_fd);
+        return -1;
+    }
+    return out_fd;
+}
+
+// Returns a memfd holding a BMP file, or -1
+static int serve_decode(pp_context* ctx, int in_fd, uint64_t* out_len) {
+    // Own descriptor so the read offset does not leak back to the client
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", in_fd);
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+
+    pp_header hdr;
+    int out_fd = -1;
+    if (pp_read_header(f, &hdr) == 0) out_fd = memfd_create("pp-decoded", MFD_CLOEXEC);
+    if (out_fd < 0) {
+        fclose(f);
+        return -1;
+    }
+
+    image_view out;
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", out_fd);
+    int ret = image_create(path, hdr.width, hdr.height, &out);
+    if (ret == 0) {
+        ret = pp_decode(ctx, f, &hdr, &out);
+        image_close(&out);
+    }
+    fclose(f);
+
+    struct stat st;
+    if (ret != 0 || fstat(out_fd, &st) != 0) {
+        close(out_fd);
+        return -1;
+    }
+    *out_len = (uint64_t)st.st_size;
+    return out_fd;
+}
+
+// Answers one request waiting on fd. Returns 0 to keep the connection,
+// -1 once the client has gone or the reply could not be sent.
+static int serve_one(int fd, pp_context* ctx) {
+    serve_request req;
+    int in_fd;
+    ssize_t n = recv_with_fd(fd, &req, sizeof(req), &in_fd);
+    if (n <= 0) return -1;
+
+    serve_response resp = { -1, 0, 0 };
+    int out_fd = -1;
+    if (ctx && n == sizeof(req) && req.magic == SERVE_MAGIC && in_fd >= 0) {
+        if (req.op == SERVE_ENCODE) out_fd = serve_encode(ctx, in_fd, req.strip_rows, (int)req.effort, &resp.length);
+        else if (req.op == SERVE_DECODE) out_fd = serve_decode(ctx, in_fd, &resp.length);
+    }
+    if (out_fd >= 0) resp.status = 0;
+    if (in_fd >= 0) close(in_fd);
+
+    int sent = send_with_fd(fd, &resp, sizeof(resp), out_fd);
+    if (out_fd >= 0) close(out_fd);
+    return sent;
+}
+
+// Hands the connection back to the listening thread through the wake
+// pipe: fd to watch it again, ~fd to close it. Only that thread closes
+// connections, so an fd number is never reused while still in its table.
+static void serve_task(void* arg, int worker) {
+    conn_task* t = arg;
+    int msg = serve_one(t->fd, t->contexts[worker]) == 0 ? t->fd : ~t->fd;
+    if (write(t->wake, &msg, sizeof(msg)) != sizeof(msg)) {
+        fprintf(stderr, "serve: lost connection %d\n", t->fd);
+    }
+    free(t);
+}
+
+// Connections being watched have fd >= 0; while a request of theirs is
+// with a worker the entry holds ~fd, which poll() skips.
+typedef struct {
+    struct pollfd* fds;     // [0] listener, [1] wake pipe, then connections
+    size_t count;
+    size_t capacity;
+} conn_table;
+
+static int conn_add(conn_table* c, int fd) {
+    if (c->count == c->capacity) {
+        size_t cap = c->capacity ? c->capacity * 2 : 64;
+        struct pollfd* fds = realloc(c->fds, cap * sizeof(struct pollfd));
+        if (!fds) return -1;
+        c->fds = fds;
+        c->capacity = cap;
+    }
+    c->fds[c->count++] = (struct pollfd){ fd, POLLIN, 0 };
+    return 0;
+}
+
+static void conn_remove(conn_table* c, size_t i) {
+    int fd = c->fds[i].fd;
+    close(fd < 0 ? ~fd : fd);
+    c->fds[i] = c->fds[--c->count];
+}
+
+static void conn_returned(conn_table* c, int msg) {
+    int fd = msg < 0 ? ~msg : msg;
+    for (size_t i = 2; i < c->count; i++) {
+        if (c->fds[i].fd != ~fd) continue;
+        if (msg < 0) conn_remove(c, i);
+        else c->fds[i].fd = fd;
+        return;
+    }
+}
+
+int serve_run(const char* socket_path, int threads, int huge_pages) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (lfd < 0) return -1;
+    unlink(socket_path);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", socket_path, strerror(errno));
+        close(lfd);
+        return -1;
+    }
+
+    // Workers inherit a mask with the stop signals blocked, so they are
+    // always delivered to this thread and interrupt accept()
+    sigset_t stop_sigs, old_mask;
+    sigemptyset(&stop_sigs);
+    sigaddset(&stop_sigs, SIGINT);
+    sigaddset(&stop_sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_sigs, &old_mask);
+
+    pool* p = pool_create(threads);
+    pp_context** contexts = p ? calloc(pool_threads(p), sizeof(pp_context*)) : NULL;
+    int wake[2] = { -1, -1 };
+    conn_table conns = {0};
+    if (!contexts || pipe2(wake, O_CLOEXEC) != 0 || conn_add(&conns, lfd) != 0 || conn_add(&conns, wake[0]) != 0) {
+        if (wake[0] >= 0) {
+            close(wake[0]);
+            close(wake[1]);
+        }
+        free(conns.fds);
+        free(contexts);
+        pool_destroy(p);
+        close(lfd);
+        unlink(socket_path);
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        return -1;
+    }
+    for (int i = 0; i < pool_threads(p); i++) {
+        contexts[i] = pp_context_create(huge_pages);
+    }
+
+    stopping = 0;
+    struct sigaction sa = {0};
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &stop_sigs, NULL);
+
+    printf("Serving on %s with %d workers\n", socket_path, pool_threads(p));
+    fflush(stdout);
+
+    // Only this thread waits on connections. Each request that arrives
+    // becomes its own pool task, so idle clients hold no worker.
+    while (!stopping) {
+        if (poll(conns.fds, conns.count, POLL_MS) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            break;
+        }
+
+        if (conns.fds[1].revents & POLLIN) {
+            int msgs[64];
+            ssize_t n = read(wake[0], msgs, sizeof(msgs));
+            for (ssize_t i = 0; i < n / (ssize_t)sizeof(int); i++) conn_returned(&conns, msgs[i]);
+        }
+
+        for (size_t i = 2; i < conns.count; i++) {
+            if (conns.fds[i].fd < 0 || !conns.fds[i].revents) continue;
+            conn_task* t = malloc(sizeof(conn_task));
+            if (t) {
+                t->fd = conns.fds[i].fd;
+                t->wake = wake[1];
+                t->contexts = contexts;
+            }
+            if (!t || pool_submit(p, serve_task, t) != 0) {
+                free(t);
+                conn_remove(&conns, i--);
+                continue;
+            }
+            conns.fds[i].fd = ~conns.fds[i].fd;
+        }
+
+        if (conns.fds[0].revents & POLLIN) {
+            int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0 && errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+                fprintf(stderr, "accept: %s\n", strerror(errno));
+                break;
+            }
+            if (fd >= 0 && conn_add(&conns, fd) != 0) close(fd);
+        }
+    }
+
+    // Requests in flight finish and reply before their connections close
+    close(lfd);
+    unlink(socket_path);
+    pool_wait(p);
+    while (conns.count > 2) conn_remove(&conns, conns.count - 1);
+    close(wake[0]);
+    close(wake[1]);
+    free(conns.fds);
+    for (int i = 0; i < pool_threads(p); i++) {
+        pp_context_free(contexts[i]);
+    }
+    pool_destroy(p);
+    free(contexts);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    return 0;
+}
+
+int serve_call(const char* socket_path, uint32_t op, int strip_rows, int effort, int in_fd,
+               int* out_fd, uint64_t* out_len) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, socket_path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+
+    serve_request req = { SERVE_MAGIC, op, strip_rows, (uint32_t)effort };
+    serve_response resp;
+    int fd = -1;
+    int ok = send_with_fd(sock, &req, sizeof(req), in_fd) == 0 &&
+             recv_with_fd(sock, &resp, sizeof(resp), &fd) == (ssize_t)sizeof(resp) &&
+             resp.status == 0 && fd >= 0;
+    close(sock);
+    if (!ok) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    *out_fd = fd;
+    *out_len = resp.length;
+    return 0;
+}
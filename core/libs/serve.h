@@ -0,0 +1,42 @@
+// serve.h -- resident encode/decode daemon on a Unix domain socket
+//
+// Requests and replies are single SOCK_SEQPACKET messages. Payloads never
+// cross the socket: the client attaches an fd (a memfd, or any regular
+// file) holding the input, and a successful reply carries a memfd with
+// the output. A connection may send any number of requests; each one is
+// a separate pool task, so idle connections hold no worker.
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+
+#define SERVE_MAGIC 0x56535050  // "PPSV"
+
+enum {
+    SERVE_ENCODE = 1,   // image file (BMP, PPM, anything stb reads) -> .pp
+    SERVE_DECODE = 2,   // .pp -> 24-bit BMP
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;
+    int32_t strip_rows;     // encode only; 0 = whole image
+    uint32_t effort;        // encode only; 0 = PP_EFFORT_DEFAULT
+} serve_request;
+
+typedef struct {
+    int32_t status;         // 0 on success, output fd attached
+    uint32_t reserved;
+    uint64_t length;        // bytes in the output fd
+} serve_response;
+
+// Listens on socket_path until SIGINT/SIGTERM, serving requests on a
+// pool of `threads` workers (0 = one per CPU) with warm codec contexts.
+int serve_run(const char* socket_path, int threads, int huge_pages);
+
+// Sends one request and waits for the reply. On success *out_fd is a
+// memfd the caller must close.
+int serve_call(const char* socket_path, uint32_t op, int strip_rows, int effort, int in_fd,
+               int* out_fd, uint64_t* out_len);
+
+#endif // SERVE_H
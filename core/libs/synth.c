@@ -0,0 +1,147 @@
+// synth.c -- deterministic synthetic test images
+#include "synth.h"
+#include "imgio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MIN_SIDE 64
+#define CHECKER_CELL 8
+#define MAX_STRIP 65536
+
+const char* const synth_pattern_names[SYNTH_PATTERN_COUNT] = {
+    "flat", "gradient", "noise", "grain", "checker", "split",
+};
+
+// splitmix64: tiny, fast, and the same sequence on every platform
+static uint64_t next_random(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int clamp(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+int synth_write(const char* path, synth_pattern pattern, int width, int height, uint64_t seed) {
+    image_view img;
+    if (image_create(path, width, height, &img) != 0) return -1;
+
+    // Mix the parameters in so every file of a corpus gets its own stream
+    uint64_t state = seed ^ ((uint64_t)pattern << 56) ^ ((uint64_t)width << 28) ^ (uint64_t)height;
+    uint64_t colour = next_random(&state);
+    int r = img.bgr ? 2 : 0, b = img.bgr ? 0 : 2;
+    double gx = width > 1 ? 255.0 / (width - 1) : 0;
+    double gy = height > 1 ? 255.0 / (height - 1) : 0;
+
+    for (int y = 0; y < height; y++) {
+        unsigned char* row = img.row0 + (ptrdiff_t)y * img.stride;
+        for (int x = 0; x < width; x++) {
+            unsigned char* px = row + (size_t)x * 3;
+            int c[3];
+            switch (pattern) {
+            case SYNTH_FLAT:
+                c[0] = (int)(colour & 0xFF);
+                c[1] = (int)(colour >> 8 & 0xFF);
+                c[2] = (int)(colour >> 16 & 0xFF);
+                break;
+            case SYNTH_GRADIENT:
+            case SYNTH_GRAIN:
+                c[0] = (int)(x * gx);
+                c[1] = (int)(y * gy);
+                c[2] = (c[0] + c[1]) / 2;
+                if (pattern == SYNTH_GRAIN) {
+                    uint64_t n = next_random(&state);
+                    for (int i = 0; i < 3; i++) c[i] = clamp(c[i] + (int)(n >> (8 * i) & 3) - 1);
+                }
+                break;
+            case SYNTH_SPLIT:
+                if (y < height / 2) {
+                    c[0] = (int)(colour & 0xFF);
+                    c[1] = (int)(colour >> 8 & 0xFF);
+                    c[2] = (int)(colour >> 16 & 0xFF);
+                    break;
+                }
+                // fall through
+            case SYNTH_NOISE: {
+                uint64_t n = next_random(&state);
+                c[0] = (int)(n & 0xFF);
+                c[1] = (int)(n >> 8 & 0xFF);
+                c[2] = (int)(n >> 16 & 0xFF);
+                break;
+            }
+            case SYNTH_CHECKER:
+            default: {
+                int v = ((x / CHECKER_CELL) + (y / CHECKER_CELL)) & 1 ? 255 : 0;
+                c[0] = c[1] = c[2] = v;
+                break;
+            }
+            }
+            px[r] = (unsigned char)c[0];
+            px[1] = (unsigned char)c[1];
+            px[b] = (unsigned char)c[2];
+        }
+        // Keep the resident set bounded for 100+ MP images
+        if ((y & 255) == 255) image_release_rows(&img, y - 255, y + 1);
+    }
+    image_close(&img);
+    return 0;
+}
+
+typedef struct {
+    int width, height;
+} synth_size;
+
+static int by_pixels(const void* a, const void* b) {
+    const synth_size* x = a;
+    const synth_size* y = b;
+    uint64_t px = (uint64_t)x->width * x->height, py = (uint64_t)y->width * y->height;
+    return (px > py) - (px < py);
+}
+
+int synth_corpus(const char* dir, uint64_t seed, uint64_t max_pixels, char* manifest, size_t len) {
+    synth_size sizes[40];
+    int nsizes = 0;
+
+    // Squares doubling from MIN_SIDE, then the largest square that fits
+    int side = MIN_SIDE;
+    for (; (uint64_t)side * side <= max_pixels && nsizes < 30; side *= 2) {
+        sizes[nsizes++] = (synth_size){ side, side };
+    }
+    int largest = (int)sqrt((double)max_pixels);
+    if (nsizes > 0 && largest > sizes[nsizes - 1].width * 5 / 4) {
+        sizes[nsizes++] = (synth_size){ largest, largest };
+    }
+
+    // 1-pixel strips: per-row overhead and a single very long row
+    int strip = max_pixels < MAX_STRIP ? (int)max_pixels : MAX_STRIP;
+    sizes[nsizes++] = (synth_size){ 1, strip };
+    sizes[nsizes++] = (synth_size){ strip, 1 };
+    qsort(sizes, nsizes, sizeof(synth_size), by_pixels);
+
+    snprintf(manifest, len, "%s/manifest.txt", dir);
+    FILE* list = fopen(manifest, "w");
+    if (!list) return -1;
+    fprintf(list, "# synthetic corpus, seed %llu\n", (unsigned long long)seed);
+
+    int count = 0;
+    for (int s = 0; s < nsizes; s++) {
+        for (int p = 0; p < SYNTH_PATTERN_COUNT; p++) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s_%dx%d.bmp", dir, synth_pattern_names[p],
+                     sizes[s].width, sizes[s].height);
+            if (synth_write(path, (synth_pattern)p, sizes[s].width, sizes[s].height, seed) != 0) {
+                fprintf(stderr, "Error: Cannot write %s: %s\n", path, image_failure_reason());
+                fclose(list);
+                return -1;
+            }
+            fprintf(list, "%s\n", path);
+            count++;
+        }
+    }
+    fclose(list);
+    return count;
+}
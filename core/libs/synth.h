@@ -0,0 +1,37 @@
+// synth.h -- deterministic synthetic test images
+//
+// Each pattern stresses one corner of the codec: flat colour is all zero
+// residuals and long runs, noise defeats both prediction and RLE (worst-case
+// expansion), grain is a gradient with +-1 noise that keeps the coder on a
+// narrow, skewed distribution, checker puts a hard edge every few pixels,
+// and split is flat colour over noise, so one strip mixes skipped blocks
+// with incompressible ones. Output depends only on pattern, size and seed.
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    SYNTH_FLAT,
+    SYNTH_GRADIENT,
+    SYNTH_NOISE,
+    SYNTH_GRAIN,
+    SYNTH_CHECKER,
+    SYNTH_SPLIT,
+    SYNTH_PATTERN_COUNT
+} synth_pattern;
+
+extern const char* const synth_pattern_names[SYNTH_PATTERN_COUNT];
+
+// Writes a width x height image (BMP, or PPM for a ".ppm" path) row by
+// row, so arbitrarily large images need no pixel buffer. Returns 0 or -1.
+int synth_write(const char* path, synth_pattern pattern, int width, int height, uint64_t seed);
+
+// Fills dir with every pattern at square sizes from 64x64 doubling up to
+// max_pixels, plus 1-pixel-wide and 1-pixel-tall strips, and writes
+// dir/manifest.txt listing them smallest first. The manifest path is
+// stored in manifest (len bytes). Returns the number of images or -1.
+int synth_corpus(const char* dir, uint64_t seed, uint64_t max_pixels, char* manifest, size_t len);
+
+#endif // SYNTH_H